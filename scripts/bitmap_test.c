@@ -0,0 +1,293 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved
+ */
+
+/**
+ * Host differential test and benchmark of the bitmap library. Every function
+ * in src/lib/bitmap.c, and the bit.h helpers it builds on, is checked against
+ * a bit at a time reference on random bitmaps and arguments. The searches are
+ * then timed against the same reference:
+ *
+ *     bitmap_test [cases] [seed]
+ *
+ * or built and run with the default arguments by the bitmap_test make goal.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+/* The library only needs the types and helpers below from bao.h */
+#define __BAO_H__
+#define max(n1, n2) (((n1) > (n2)) ? (n1) : (n2))
+#define min(n1, n2) (((n1) < (n2)) ? (n1) : (n2))
+
+#include "../src/lib/bitmap.c"
+
+#define TEST_CASES_DEFAULT (200000)
+#define TEST_BITS_MAX (700)
+#define BENCH_BITS (1 << 16)
+#define BENCH_ITERS (2000)
+
+static uint64_t rng_state;
+
+static uint64_t rng()
+{
+    /* xorshift64* */
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static size_t rng_range(size_t n)
+{
+    return n == 0 ? 0 : (size_t)(rng() % n);
+}
+
+static ssize_t ref_find_nth(bitmap_t* map, size_t size, size_t nth,
+                            size_t start, bool set)
+{
+    if (size == 0 || nth == 0) return -1;
+
+    for (size_t i = start; i < size; i++) {
+        if (bitmap_get(map, i) == set && --nth == 0) {
+            return (ssize_t)i;
+        }
+    }
+
+    return -1;
+}
+
+static size_t ref_count(bitmap_t* map, size_t start, size_t end, bool set)
+{
+    size_t count = 0;
+
+    for (size_t i = start; i < end; i++) {
+        count += bitmap_get(map, i) == set;
+    }
+
+    return count;
+}
+
+static size_t ref_count_consecutive(bitmap_t* map, size_t size, size_t start,
+                                    size_t n)
+{
+    if (n <= 1) return n;
+    if (start >= size) return 0;
+
+    unsigned bit = bitmap_get(map, start);
+    size_t count = 0;
+
+    while (count < n && start + count < size &&
+           bitmap_get(map, start + count) == bit) {
+        count++;
+    }
+
+    return count;
+}
+
+static ssize_t ref_find_consec(bitmap_t* map, size_t size, size_t start,
+                               size_t n, bool set)
+{
+    for (size_t i = start; i < size; i++) {
+        if (bitmap_get(map, i) == set &&
+            ref_count_consecutive(map, size, i, n) >= n) {
+            return (ssize_t)i;
+        }
+    }
+
+    return -1;
+}
+
+static void ref_update_consecutive(bitmap_t* map, size_t start, size_t n,
+                                   bool set)
+{
+    for (size_t i = start; i < start + n; i++) {
+        if (set) {
+            bitmap_set(map, i);
+        } else {
+            bitmap_clear(map, i);
+        }
+    }
+}
+
+/* Mixes uniform, sparse, dense and long-run bitmaps */
+static void fill(bitmap_t* map, size_t size)
+{
+    size_t words = BITMAP_SIZE(size);
+
+    switch (rng_range(5)) {
+        case 0:
+            for (size_t i = 0; i < words; i++) map[i] = rng();
+            break;
+        case 1:
+            for (size_t i = 0; i < words; i++) map[i] = rng() & rng() & rng();
+            break;
+        case 2:
+            for (size_t i = 0; i < words; i++) map[i] = rng() | rng() | rng();
+            break;
+        case 3: {
+            bool set = rng() & 1;
+            size_t i = 0;
+            while (i < size) {
+                size_t run = 1 + rng_range(3 * BITMAP_GRANULE_LEN);
+                ref_update_consecutive(map, i, min(run, size - i), set);
+                i += run;
+                set = !set;
+            }
+            break;
+        }
+        default:
+            memset(map, (rng() & 1) ? 0xff : 0, words * sizeof(bitmap_t));
+            for (size_t i = rng_range(4); i > 0; i--) {
+                map[rng_range(words)] ^= ONE << rng_range(BITMAP_GRANULE_LEN);
+            }
+    }
+}
+
+static size_t failures;
+
+#define CHECK(expr, fmt, ...)                                           \
+    if (!(expr)) {                                                      \
+        if (failures++ < 10) {                                          \
+            printf("case %lu: " fmt "\n", (unsigned long)c, __VA_ARGS__); \
+        }                                                               \
+    }
+
+static void test(size_t cases)
+{
+    BITMAP_ALLOC(map, TEST_BITS_MAX);
+    BITMAP_ALLOC(lib, TEST_BITS_MAX);
+    BITMAP_ALLOC(ref, TEST_BITS_MAX);
+
+    for (size_t c = 0; c < cases; c++) {
+        size_t size = 1 + rng_range(TEST_BITS_MAX);
+        size_t start = rng_range(size + 2);
+        size_t end = start + rng_range(size + 1 - min(start, size));
+        size_t nth = rng_range(size / 2 + 2);
+        size_t n = (rng() & 1) ? rng_range(8) : rng_range(size + 2);
+        bool set = rng() & 1;
+
+        fill(map, size);
+
+        unsigned long word = map[0] != 0 ? map[0] : 1;
+        CHECK(bit_ctz(word) == (size_t)__builtin_ctzl(word) &&
+              bit_clz(word) == (size_t)__builtin_clzl(word) &&
+              bit_count(word) == (size_t)__builtin_popcountl(word),
+              "bit ops differ on 0x%lx", word);
+
+        ssize_t got = bitmap_find_nth(map, size, nth, start, set);
+        ssize_t exp = ref_find_nth(map, size, nth, start, set);
+        CHECK(got == exp, "find_nth(size %lu, nth %lu, start %lu, %d) = %ld, "
+              "expected %ld", (unsigned long)size, (unsigned long)nth,
+              (unsigned long)start, set, (long)got, (long)exp);
+
+        size_t cnt = bitmap_count(map, start, end, set);
+        size_t cnt_exp = ref_count(map, start, end, set);
+        CHECK(cnt == cnt_exp, "count(%lu, %lu, %d) = %lu, expected %lu",
+              (unsigned long)start, (unsigned long)end, set,
+              (unsigned long)cnt, (unsigned long)cnt_exp);
+
+        cnt = bitmap_count_consecutive(map, size, start, n);
+        cnt_exp = ref_count_consecutive(map, size, start, n);
+        CHECK(cnt == cnt_exp, "count_consecutive(size %lu, start %lu, n %lu) "
+              "= %lu, expected %lu", (unsigned long)size, (unsigned long)start,
+              (unsigned long)n, (unsigned long)cnt, (unsigned long)cnt_exp);
+
+        got = bitmap_find_consec(map, size, start, n, set);
+        exp = ref_find_consec(map, size, start, n, set);
+        CHECK(got == exp, "find_consec(size %lu, start %lu, n %lu, %d) = %ld, "
+              "expected %ld", (unsigned long)size, (unsigned long)start,
+              (unsigned long)n, set, (long)got, (long)exp);
+
+        if (start < size) {
+            size_t len = rng_range(size - start + 1);
+            memcpy(lib, map, sizeof(map));
+            memcpy(ref, map, sizeof(map));
+            if (set) {
+                bitmap_set_consecutive(lib, start, len);
+            } else {
+                bitmap_clear_consecutive(lib, start, len);
+            }
+            ref_update_consecutive(ref, start, len, set);
+            CHECK(!memcmp(lib, ref, sizeof(map)), "%s_consecutive(%lu, %lu) "
+                  "differs", set ? "set" : "clear", (unsigned long)start,
+                  (unsigned long)len);
+        }
+    }
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static volatile ssize_t sink;
+
+#define BENCH(name, lib_call, ref_call)                                   \
+    {                                                                     \
+        double t0 = now_ns();                                             \
+        for (size_t i = 0; i < BENCH_ITERS; i++) sink = (ssize_t)(lib_call); \
+        double t1 = now_ns();                                             \
+        for (size_t i = 0; i < BENCH_ITERS; i++) sink = (ssize_t)(ref_call); \
+        double t2 = now_ns();                                             \
+        printf("%-20s %10.0f ns %10.0f ns %6.1fx\n", name,                \
+               (t1 - t0) / BENCH_ITERS, (t2 - t1) / BENCH_ITERS,          \
+               (t2 - t1) / (t1 - t0));                                    \
+    }
+
+/**
+ * A page pool like bitmap, mostly allocated, whose only free run long enough
+ * for the searches is near its end.
+ */
+static void bench()
+{
+    static BITMAP_ALLOC(map, BENCH_BITS);
+    size_t size = BENCH_BITS;
+
+    for (size_t i = 0; i < BITMAP_SIZE(size); i++) {
+        map[i] = rng() | rng() | rng() | rng();
+    }
+    bitmap_clear_consecutive(map, size - 200, 64);
+
+    printf("%-20s %13s %13s %7s\n", "", "bitmap.c", "reference", "");
+    BENCH("find_nth", bitmap_find_nth(map, size, 100, 0, false),
+          ref_find_nth(map, size, 100, 0, false));
+    BENCH("count", bitmap_count(map, 0, size, true),
+          ref_count(map, 0, size, true));
+    BENCH("count_consecutive",
+          bitmap_count_consecutive(map, size, size - 200, size),
+          ref_count_consecutive(map, size, size - 200, size));
+    BENCH("find_consec", bitmap_find_consec(map, size, 0, 64, false),
+          ref_find_consec(map, size, 0, 64, false));
+}
+
+int main(int argc, char* argv[])
+{
+    size_t cases = (argc > 1) ? strtoul(argv[1], NULL, 0) : TEST_CASES_DEFAULT;
+    uint64_t seed = (argc > 2) ? strtoull(argv[2], NULL, 0) : (uint64_t)time(NULL);
+
+    rng_state = seed | 1;
+    printf("bitmap_test: %lu cases, seed 0x%llx\n", (unsigned long)cases,
+           (unsigned long long)seed);
+
+    test(cases);
+    if (failures != 0) {
+        printf("bitmap_test: %lu failures\n", (unsigned long)failures);
+        return EXIT_FAILURE;
+    }
+    printf("bitmap_test: passed\n");
+
+    bench();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved
+ */
+
+/**
+ * Decodes a raw dump of the hypervisor trace buffer (TRACE=y), e.g. read by
+ * a VM from the trace shared memory region, into a timeline ordered by
+ * timestamp:
+ *
+ *     trace_decode <dump file>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <trace_format.h>
+
+static const char* event_names[TRACE_EV_NUM] = {
+    [TRACE_EV_NONE] = "none",
+    [TRACE_EV_IRQ] = "irq",
+    [TRACE_EV_CPU_MSG] = "cpu_msg",
+    [TRACE_EV_HYPERCALL] = "hypercall",
+    [TRACE_EV_ABORT] = "abort",
+    [TRACE_EV_SYNC_EXCP] = "sync_excp",
+    [TRACE_EV_VGIC_SPILL] = "vgic_spill",
+    [TRACE_EV_VGIC_REFILL] = "vgic_refill",
+    [TRACE_EV_MEMGUARD] = "memguard",
+};
+
+static int record_cmp(const void* a, const void* b)
+{
+    const struct trace_record* ra = a;
+    const struct trace_record* rb = b;
+
+    if (ra->timestamp != rb->timestamp) {
+        return ra->timestamp < rb->timestamp ? -1 : 1;
+    }
+    return (int)ra->cpuid - (int)rb->cpuid;
+}
+
+static void print_id(uint16_t id)
+{
+    if (id == TRACE_NO_ID) {
+        printf("  -");
+    } else {
+        printf("%3u", id);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <trace dump>\n", argv[0]);
+        return 1;
+    }
+
+    FILE* f = fopen(argv[1], "rb");
+    if (f == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* buf = malloc(size);
+    if (buf == NULL || fread(buf, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "failed to read %s\n", argv[1]);
+        return 1;
+    }
+    fclose(f);
+
+    struct trace_header* hdr = (struct trace_header*)buf;
+    if ((size_t)size < sizeof(*hdr) || hdr->magic != TRACE_MAGIC ||
+        hdr->version != TRACE_VERSION ||
+        hdr->record_size != sizeof(struct trace_record) ||
+        hdr->record_num == 0 ||
+        (hdr->record_num & (hdr->record_num - 1)) != 0) {
+        fprintf(stderr, "not a valid trace buffer\n");
+        return 1;
+    }
+
+    size_t ring_size = (size_t)hdr->record_num * hdr->record_size;
+    if (hdr->rings_offset + (hdr->cpu_num * ring_size) > (size_t)size) {
+        fprintf(stderr, "truncated trace buffer\n");
+        return 1;
+    }
+
+    struct trace_record* timeline =
+        calloc((size_t)hdr->cpu_num * hdr->record_num, sizeof(*timeline));
+    size_t n = 0;
+    uint32_t lost = 0;
+
+    for (size_t cpu = 0; cpu < hdr->cpu_num; cpu++) {
+        struct trace_ring_ctl* ctl = &hdr->ring[cpu];
+        struct trace_record* ring =
+            (struct trace_record*)(buf + hdr->rings_offset + cpu * ring_size);
+        uint32_t commit = ctl->commit;
+        uint32_t head = ctl->head;
+        uint32_t count = commit < hdr->record_num ? commit : hdr->record_num;
+        uint32_t first = commit - count;
+
+        /* a record being written when the dump was taken is not valid */
+        if (head - first > hdr->record_num) {
+            uint32_t skip = head - first - hdr->record_num;
+            skip = skip > count ? count : skip;
+            first += skip;
+            count -= skip;
+        }
+        lost += commit - count;
+
+        for (uint32_t i = 0; i < count; i++) {
+            timeline[n++] = ring[(first + i) & (hdr->record_num - 1)];
+        }
+    }
+
+    qsort(timeline, n, sizeof(*timeline), record_cmp);
+
+    printf("# %zu records from %u cpus, %u overwritten\n", n, hdr->cpu_num,
+           lost);
+    printf("# %20s cpu  vm vcpu event        arg0               arg1\n",
+           hdr->timer_freq != 0 ? "time (ns)" : "time (ticks)");
+
+    uint64_t start = n > 0 ? timeline[0].timestamp : 0;
+    for (size_t i = 0; i < n; i++) {
+        struct trace_record* rec = &timeline[i];
+        uint64_t t = rec->timestamp - start;
+        if (hdr->timer_freq != 0) {
+            t = (uint64_t)((t * 1000000000.0) / hdr->timer_freq);
+        }
+        printf("  %20llu %3u ", (unsigned long long)t, rec->cpuid);
+        print_id(rec->vmid);
+        printf("  ");
+        print_id(rec->vcpuid);
+        const char* name =
+            rec->event < TRACE_EV_NUM ? event_names[rec->event] : "unknown";
+        printf(" %-12s 0x%016llx 0x%016llx\n", name,
+               (unsigned long long)rec->args[0],
+               (unsigned long long)rec->args[1]);
+    }
+
+    free(timeline);
+    free(buf);
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_ATOMIC_H__
+#define __ARCH_ATOMIC_H__
+
+#include <bao.h>
+
+static inline unsigned long atomic_load_acq(volatile unsigned long* ptr)
+{
+    unsigned long val;
+
+    asm volatile("lda %0, %1\n\t" : "=r"(val) : "Q"(*ptr) : "memory");
+
+    return val;
+}
+
+static inline void atomic_store_rel(volatile unsigned long* ptr,
+                                    unsigned long val)
+{
+    asm volatile("stl %1, %0\n\t" : "=Q"(*ptr) : "r"(val) : "memory");
+}
+
+static inline unsigned long atomic_fetch_add(volatile unsigned long* ptr,
+                                             unsigned long val)
+{
+    unsigned long old, new;
+    uint32_t fail;
+
+    asm volatile(
+        "1:\n\t"
+        "ldaex %0, %3 \n\t"
+        "add %1, %0, %4 \n\t"
+        "stlex %2, %1, %3 \n\t"
+        "cmp %2, #0 \n\t"
+        "bne 1b \n\t"
+        : "=&r"(old), "=&r"(new), "=&r"(fail), "+Q"(*ptr)
+        : "r"(val) : "cc", "memory");
+
+    return old;
+}
+
+static inline unsigned long atomic_swap(volatile unsigned long* ptr,
+                                        unsigned long val)
+{
+    unsigned long old;
+    uint32_t fail;
+
+    asm volatile(
+        "1:\n\t"
+        "ldaex %0, %2 \n\t"
+        "stlex %1, %3, %2 \n\t"
+        "cmp %1, #0 \n\t"
+        "bne 1b \n\t"
+        : "=&r"(old), "=&r"(fail), "+Q"(*ptr)
+        : "r"(val) : "cc", "memory");
+
+    return old;
+}
+
+static inline bool atomic_cas(volatile unsigned long* ptr, unsigned long expected,
+                              unsigned long desired)
+{
+    unsigned long old;
+    uint32_t fail;
+
+    asm volatile(
+        "1:\n\t"
+        "ldaex %0, %2 \n\t"
+        "cmp %0, %3 \n\t"
+        "bne 2f \n\t"
+        "stlex %1, %4, %2 \n\t"
+        "cmp %1, #0 \n\t"
+        "bne 1b \n\t"
+        "2:\n\t"
+        : "=&r"(old), "=&r"(fail), "+Q"(*ptr)
+        : "r"(expected), "r"(desired) : "cc", "memory");
+
+    return old == expected;
+}
+
+/**
+ * Waits in WFE until the value at ptr differs from old. The location is kept
+ * in the exclusive monitor so a store from another cpu generates the event.
+ */
+static inline unsigned long atomic_wait_neq(volatile unsigned long* ptr,
+                                            unsigned long old)
+{
+    unsigned long val;
+
+    asm volatile(
+        "sevl \n\t"
+        "1:\n\t"
+        "wfe \n\t"
+        "ldaex %0, %1 \n\t"
+        "cmp %0, %2 \n\t"
+        "beq 1b \n\t"
+        : "=&r"(val) : "Q"(*ptr), "r"(old) : "cc", "memory");
+
+    return val;
+}
+
+#endif /* __ARCH_ATOMIC_H__ */
@@ -8,14 +8,75 @@
 
 #include <bao.h>
 
-typedef volatile uint32_t spinlock_t;
+typedef volatile uint32_t raw_spinlock_t;
 
-#define SPINLOCK_INITVAL (0)
+#define RAW_SPINLOCK_INITVAL (0)
 
-static inline void spin_lock(spinlock_t* lock)
+#ifdef SPINLOCK_TICKET
+
+/**
+ * Ticket lock. The upper half of the lock word holds the next ticket to be
+ * handed out, the lower half the ticket currently being served. Waiters
+ * sleep on WFE and are woken by the SEV issued on release.
+ */
+
+static inline bool raw_spin_is_locked(raw_spinlock_t* lock)
+{
+    uint32_t val = *lock;
+    return (val >> 16) != (val & 0xffff);
+}
+
+static inline void raw_spin_lock(raw_spinlock_t* lock)
 {
-    spinlock_t const ONE = 1;
-    spinlock_t tmp;
+    uint32_t const TICKET_INC = (1 << 16);
+    uint32_t val;
+    uint32_t tmp;
+    uint32_t fail;
+
+    asm volatile(
+        "1:\n\t"
+        "ldaex %0, %3 \n\t"
+        "add %1, %0, %4 \n\t"
+        "strex %2, %1, %3 \n\t"
+        "teq %2, #0 \n\t"
+        "bne 1b \n\t"
+        : "=&r"(val), "=&r"(tmp), "=&r"(fail), "+Q"(*lock)
+        : "r"(TICKET_INC) : "cc", "memory");
+
+    uint32_t ticket = val >> 16;
+    uint32_t owner = val & 0xffff;
+    while (owner != ticket) {
+        asm volatile(
+            "wfe \n\t"
+            "ldah %0, %1 \n\t"
+            : "=r"(owner) : "Q"(*(volatile uint16_t*)lock) : "memory");
+    }
+}
+
+static inline void raw_spin_unlock(raw_spinlock_t* lock)
+{
+    uint32_t tmp;
+
+    asm volatile(
+        "ldrh %0, %1 \n\t"
+        "add %0, %0, #1 \n\t"
+        "stlh %0, %1 \n\t"
+        "dsb ishst \n\t"
+        "sev \n\t"
+        : "=&r"(tmp), "+Q"(*(volatile uint16_t*)lock) :: "memory");
+}
+
+#else
+
+static inline bool raw_spin_is_locked(raw_spinlock_t* lock)
+{
+    return *lock != 0;
+}
+
+static inline void raw_spin_lock(raw_spinlock_t* lock)
+{
+    raw_spinlock_t const ONE = 1;
+    raw_spinlock_t tmp;
 
     asm volatile(
         "1:\n\t"
@@ -28,10 +89,12 @@ static inline void spin_lock(spinlock_t* lock)
         : "r"(ONE) : "memory");
 }
 
-static inline void spin_unlock(spinlock_t* lock)
+static inline void raw_spin_unlock(raw_spinlock_t* lock)
 {
-    spinlock_t const ZERO = 0;
+    raw_spinlock_t const ZERO = 0;
     asm volatile("stl %r0, %1\n\t" ::"r"(ZERO), "Q"(*lock) : "memory");
 }
 
+#endif /* SPINLOCK_TICKET */
+
 #endif /* __ARCH_SPINLOCK__ */
@@ -3,24 +3,83 @@
  * Copyright (c) Bao Project and Contributors. All rights reserved.
  */
 
-/**
- * TODO: this is a naive implementation to get things going.
- * Optimizations needed. See ticket locks in ARMv8-A.
- */
-
 #ifndef __ARCH_SPINLOCK__
 #define __ARCH_SPINLOCK__
 
 #include <bao.h>
 
-typedef volatile uint32_t spinlock_t;
+typedef volatile uint32_t raw_spinlock_t;
 
-#define SPINLOCK_INITVAL (0)
+#define RAW_SPINLOCK_INITVAL (0)
+
+#ifdef SPINLOCK_TICKET
+
+/**
+ * Ticket lock. The upper half of the lock word holds the next ticket to be
+ * handed out, the lower half the ticket currently being served. Waiters
+ * sleep on WFE with the owner half in their exclusive monitor, so the
+ * releasing store wakes them up without an explicit SEV.
+ */
 
-static inline void spin_lock(spinlock_t* lock)
+static inline bool raw_spin_is_locked(raw_spinlock_t* lock)
 {
-    spinlock_t const ONE = 1;
-    spinlock_t tmp;
+    uint32_t val = *lock;
+    return (val >> 16) != (val & 0xffff);
+}
+
+static inline void raw_spin_lock(raw_spinlock_t* lock)
+{
+    uint32_t const TICKET_INC = (1 << 16);
+    uint32_t ticket;
+    uint32_t tmp;
+    uint32_t fail;
+
+    asm volatile(
+        "1:\n\t"
+        "ldaxr %w0, %3 \n\t"
+        "add %w1, %w0, %w5 \n\t"
+        "stxr %w2, %w1, %3 \n\t"
+        "cbnz %w2, 1b \n\t"
+        "eor %w1, %w0, %w0, ror #16 \n\t"
+        "cbz %w1, 3f \n\t"
+        "sevl \n\t"
+        "2:\n\t"
+        "wfe \n\t"
+        "ldaxrh %w2, %4 \n\t"
+        "eor %w1, %w2, %w0, lsr #16 \n\t"
+        "cbnz %w1, 2b \n\t"
+        "3:\n\t"
+        : "=&r"(ticket), "=&r"(tmp), "=&r"(fail), "+Q"(*lock)
+        : "Q"(*(volatile uint16_t*)lock), "r"(TICKET_INC) : "memory");
+}
+
+static inline void raw_spin_unlock(raw_spinlock_t* lock)
+{
+    uint32_t tmp;
+
+    asm volatile(
+        "ldrh %w0, %1 \n\t"
+        "add %w0, %w0, #1 \n\t"
+        "stlrh %w0, %1 \n\t"
+        : "=&r"(tmp), "+Q"(*(volatile uint16_t*)lock) :: "memory");
+}
+
+#else
+
+/**
+ * TODO: this is a naive implementation to get things going.
+ * Optimizations needed. See ticket locks in ARMv8-A.
+ */
+
+static inline bool raw_spin_is_locked(raw_spinlock_t* lock)
+{
+    return *lock != 0;
+}
+
+static inline void raw_spin_lock(raw_spinlock_t* lock)
+{
+    raw_spinlock_t const ONE = 1;
+    raw_spinlock_t tmp;
 
     asm volatile(
         "1:\n\t"
@@ -32,9 +91,11 @@ static inline void spin_lock(spinlock_t* lock)
         : "r"(ONE) : "memory");
 }
 
-static inline void spin_unlock(spinlock_t* lock)
+static inline void raw_spin_unlock(raw_spinlock_t* lock)
 {
     asm volatile("stlr wzr, %0\n\t" ::"Q"(*lock) : "memory");
 }
 
+#endif /* SPINLOCK_TICKET */
+
 #endif /* __ARCH_SPINLOCK__ */
@@ -73,7 +73,19 @@ SYSREG_GEN_ACCESSORS(cntvoff_el2);
 SYSREG_GEN_ACCESSORS(sctlr_el1);
 SYSREG_GEN_ACCESSORS(cntkctl_el1);
 SYSREG_GEN_ACCESSORS(cntfrq_el0);
+SYSREG_GEN_ACCESSORS(cntpct_el0);
 SYSREG_GEN_ACCESSORS(pmcr_el0);
+SYSREG_GEN_ACCESSORS(pmcntenset_el0);
+SYSREG_GEN_ACCESSORS(pmcntenclr_el0);
+SYSREG_GEN_ACCESSORS(pmovsclr_el0);
+SYSREG_GEN_ACCESSORS(pmselr_el0);
+SYSREG_GEN_ACCESSORS(pmxevtyper_el0);
+SYSREG_GEN_ACCESSORS(pmxevcntr_el0);
+SYSREG_GEN_ACCESSORS(pmintenset_el1);
+SYSREG_GEN_ACCESSORS(pmintenclr_el1);
+SYSREG_GEN_ACCESSORS(mdcr_el2);
+SYSREG_GEN_ACCESSORS(cnthp_ctl_el2);
+SYSREG_GEN_ACCESSORS(cnthp_cval_el2);
 SYSREG_GEN_ACCESSORS(par_el1);
 SYSREG_GEN_ACCESSORS(tcr_el2);
 SYSREG_GEN_ACCESSORS(ttbr0_el2);
@@ -83,6 +95,7 @@ SYSREG_GEN_ACCESSORS(hcr_el2);
 SYSREG_GEN_ACCESSORS(vtcr_el2);
 SYSREG_GEN_ACCESSORS(vttbr_el2);
 SYSREG_GEN_ACCESSORS(id_aa64mmfr0_el1);
+SYSREG_GEN_ACCESSORS(id_aa64isar0_el1);
 SYSREG_GEN_ACCESSORS(tpidr_el2);
 SYSREG_GEN_ACCESSORS(vsctlr_el2);
 SYSREG_GEN_ACCESSORS(mpuir_el2);
@@ -141,14 +154,38 @@ static inline void arm_tlbi_vmalls12e1is() {
     asm volatile("tlbi vmalls12e1is");
 }
 
+static inline void arm_tlbi_alle2() {
+    asm volatile("tlbi alle2");
+}
+
+static inline void arm_tlbi_vmalle1is() {
+    asm volatile("tlbi vmalle1is");
+}
+
 static inline void arm_tlbi_vae2is(vaddr_t vaddr) {
     asm volatile("tlbi vae2is, %0" ::"r"(vaddr >> 12));
 }
 
+static inline void arm_tlbi_vae2(vaddr_t vaddr) {
+    asm volatile("tlbi vae2, %0" ::"r"(vaddr >> 12));
+}
+
 static inline void arm_tlbi_ipas2e1is(vaddr_t vaddr) {
     asm volatile("tlbi ipas2e1is, %0" ::"r"(vaddr >> 12));
 }
 
+/**
+ * FEAT_TLBIRANGE operations, written as plain sys instructions so they
+ * don't depend on the assembler supporting armv8.4-a.
+ */
+static inline void arm_tlbi_rvae2is(unsigned long arg) {
+    asm volatile("sys #4, c8, c2, #1, %0" ::"r"(arg)); // tlbi rvae2is
+}
+
+static inline void arm_tlbi_ripas2e1is(unsigned long arg) {
+    asm volatile("sys #4, c8, c0, #2, %0" ::"r"(arg)); // tlbi ripas2e1is
+}
+
 #endif /* |__ASSEMBLER__ */
 
 #endif /* __ARCH_SYSREGS_H__ */
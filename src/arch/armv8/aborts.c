@@ -11,6 +11,7 @@
 #include <emul.h>
 #include <config.h>
 #include <hypercall.h>
+#include <trace.h>
 
 typedef void (*abort_handler_t)(unsigned long, unsigned long, unsigned long, unsigned long);
 
@@ -182,6 +183,8 @@ void aborts_sync_handler()
     unsigned long il = bit64_extract(esr, ESR_IL_OFF, ESR_IL_LEN);
     unsigned long iss = bit64_extract(esr, ESR_ISS_OFF, ESR_ISS_LEN);
 
+    trace_event(TRACE_EV_ABORT, ec, ipa_fault_addr);
+
     abort_handler_t handler = abort_handlers[ec];
     if (handler)
         handler(iss, ipa_fault_addr, il, ec);
@@ -10,6 +10,9 @@
 #include <arch/sysregs.h>
 #include <arch/fences.h>
 
+/* invalid entries are never cached, so new mappings need no invalidation */
+#define TLB_ARCH_CACHES_INVALID (false)
+
 static inline void tlb_hyp_inv_va(vaddr_t va)
 {
     DSB(ish);
@@ -26,46 +29,168 @@ static inline void tlb_hyp_inv_all()
     ISB();
 }
 
-static inline void tlb_vm_inv_va(asid_t vmid, vaddr_t va)
+static inline void tlb_hyp_inv_va_local(vaddr_t va)
+{
+    DSB(nshst);
+    arm_tlbi_vae2(va);
+    DSB(nsh);
+    ISB();
+}
+
+static inline void tlb_hyp_inv_all_local()
 {
-    uint64_t vttbr = 0;
-    vttbr = sysreg_vttbr_el2_read();
-    bool switch_vmid =
-        bit64_extract(vttbr, VTTBR_VMID_OFF, VTTBR_VMID_LEN) != vmid;
+    DSB(nshst);
+    arm_tlbi_alle2();
+    DSB(nsh);
+    ISB();
+}
 
-    if (switch_vmid) {
+/**
+ * Stage-2 maintenance must be issued with the target VMID in VTTBR_EL2.
+ * Returns the value to give tlb_vm_restore once done.
+ */
+static inline uint64_t tlb_vm_switch(asid_t vmid)
+{
+    uint64_t vttbr = sysreg_vttbr_el2_read();
+
+    if (bit64_extract(vttbr, VTTBR_VMID_OFF, VTTBR_VMID_LEN) != vmid) {
         sysreg_vttbr_el2_write((((uint64_t)vmid << VTTBR_VMID_OFF) & VTTBR_VMID_MSK));
-        DSB(ish);
         ISB();
     }
 
-    arm_tlbi_ipas2e1is(va);
+    return vttbr;
+}
 
-    if (switch_vmid) {
-        DSB(ish);
-        sysreg_vttbr_el2_write((((uint64_t)vmid << VTTBR_VMID_OFF) & VTTBR_VMID_MSK));
+static inline void tlb_vm_restore(uint64_t vttbr)
+{
+    if (sysreg_vttbr_el2_read() != vttbr) {
+        sysreg_vttbr_el2_write(vttbr);
+        ISB();
     }
 }
 
 static inline void tlb_vm_inv_all(asid_t vmid)
 {
-    uint64_t vttbr = 0;
-    vttbr = sysreg_vttbr_el2_read();
-    bool switch_vmid =
-        bit64_extract(vttbr, VTTBR_VMID_OFF, VTTBR_VMID_LEN) != vmid;
+    DSB(ish);
+    uint64_t vttbr = tlb_vm_switch(vmid);
+    arm_tlbi_vmalls12e1is();
+    DSB(ish);
+    tlb_vm_restore(vttbr);
+}
 
-    if (switch_vmid) {
-        sysreg_vttbr_el2_write((((uint64_t)vmid << VTTBR_VMID_OFF) & VTTBR_VMID_MSK));
-        DSB(ish);
-        ISB();
+#ifndef AARCH32
+
+/* pages covered by range operations with all four scales */
+#define TLBI_RANGE_MAX_PAGES (1UL << 21)
+
+/* whether size bytes can be invalidated with a few range operations */
+static inline bool tlb_arch_range(size_t size)
+{
+    return (NUM_PAGES(size) < TLBI_RANGE_MAX_PAGES) &&
+           (bit64_extract(sysreg_id_aa64isar0_el1_read(), ID_AA64ISAR0_TLB_OFF,
+                          ID_AA64ISAR0_TLB_LEN) >= ID_AA64ISAR0_TLB_RANGE);
+}
+
+static inline unsigned long tlbi_range_arg(vaddr_t va, size_t num,
+                                           size_t scale)
+{
+    /* 4KiB granule, no level hint */
+    return (1UL << 46) | (scale << 44) | ((num - 1) << 39) |
+           ((va >> 12) & ((1UL << 37) - 1));
+}
+
+/**
+ * Covers [va, va + size[ by splitting the page count in its binary
+ * digits: odd pages one by one, then up to 31 blocks of 2^(5*scale+1)
+ * pages for each scale.
+ */
+static inline void tlb_arm_inv_range(vaddr_t va, size_t size, bool stage2)
+{
+    size_t pages = size / PAGE_SIZE;
+    size_t scale = 0;
+
+    while (pages > 0) {
+        if (pages % 2) {
+            if (stage2) {
+                arm_tlbi_ipas2e1is(va);
+            } else {
+                arm_tlbi_vae2is(va);
+            }
+            va += PAGE_SIZE;
+            pages--;
+            continue;
+        }
+
+        size_t num = (pages >> ((5 * scale) + 1)) & 0x1f;
+        if (num != 0) {
+            unsigned long arg = tlbi_range_arg(va, num, scale);
+            if (stage2) {
+                arm_tlbi_ripas2e1is(arg);
+            } else {
+                arm_tlbi_rvae2is(arg);
+            }
+            size_t n = num << ((5 * scale) + 1);
+            va += n * PAGE_SIZE;
+            pages -= n;
+        }
+        scale++;
     }
+}
 
-    arm_tlbi_vmalls12e1is();
+#else
 
-    if (switch_vmid) {
-        DSB(ish);
-        sysreg_vttbr_el2_write((((uint64_t)vmid << VTTBR_VMID_OFF) & VTTBR_VMID_MSK));
+static inline bool tlb_arch_range(size_t size)
+{
+    return false;
+}
+
+static inline void tlb_arm_inv_range(vaddr_t va, size_t size, bool stage2) { }
+
+#endif /* AARCH32 */
+
+/**
+ * Only called if tlb_arch_range(size) or if the caller decided invalidating
+ * each stride apart is cheaper than invalidating everything.
+ */
+static inline void tlb_hyp_inv_range(vaddr_t va, size_t size, size_t stride)
+{
+    DSB(ish);
+    if (tlb_arch_range(size)) {
+        tlb_arm_inv_range(va, size, false);
+    } else {
+        for (vaddr_t addr = va; addr < va + size; addr += stride) {
+            arm_tlbi_vae2is(addr);
+        }
     }
+    DSB(ish);
+    ISB();
+}
+
+static inline void tlb_vm_inv_range(asid_t vmid, vaddr_t va, size_t size,
+                                    size_t stride)
+{
+    DSB(ish);
+    uint64_t vttbr = tlb_vm_switch(vmid);
+    if (tlb_arch_range(size)) {
+        tlb_arm_inv_range(va, size, true);
+    } else {
+        for (vaddr_t addr = va; addr < va + size; addr += stride) {
+            arm_tlbi_ipas2e1is(addr);
+        }
+    }
+    /**
+     * Stage-2 only entries are gone, but combined stage-1 and stage-2 ones
+     * can only be invalidated for the whole VMID.
+     */
+    DSB(ish);
+    arm_tlbi_vmalle1is();
+    DSB(ish);
+    tlb_vm_restore(vttbr);
+}
+
+static inline void tlb_vm_inv_va(asid_t vmid, vaddr_t va)
+{
+    tlb_vm_inv_range(vmid, va, PAGE_SIZE, PAGE_SIZE);
 }
 
 #endif /* __ARCH_TLB_H__ */
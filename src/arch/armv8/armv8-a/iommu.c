@@ -68,6 +68,12 @@ inline bool iommu_arch_vm_add_device(struct vm *vm, streamid_t id)
     return iommu_vm_arch_add(vm, 0, id);
 }
 
+/* A context bank is only set up once a device or group was added */
+bool iommu_arch_vm_has_devices(struct vm *vm)
+{
+    return (ssize_t)vm->io.prot.mmu.ctx_id >= 0;
+}
+
 bool iommu_arch_vm_init(struct vm *vm, const struct vm_config *config)
 {
     vm->io.prot.mmu.global_mask = 
@@ -4,7 +4,7 @@
  */
 
 #include <arch/smmuv2.h>
-#include <arch/spinlock.h>
+#include <spinlock.h>
 #include <bitmap.h>
 #include <bit.h>
 #include <arch/sysregs.h>
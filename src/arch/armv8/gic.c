@@ -19,6 +19,7 @@
 #include <spinlock.h>
 #include <platform.h>
 #include <fences.h>
+#include <trace.h>
 
 volatile struct gicd_hw *gicd;
 spinlock_t gicd_lock;
@@ -98,6 +99,7 @@ void gic_handle()
     irqid_t id = bit32_extract(ack, GICC_IAR_ID_OFF, GICC_IAR_ID_LEN);
 
     if (id < GIC_FIRST_SPECIAL_INTID) {
+        trace_event(TRACE_EV_IRQ, id, 0);
         enum irq_res res = interrupts_handle(id);
         gicc_eoir(ack);
         if (res == HANDLED_BY_HYP) gicc_dir(ack);
@@ -39,7 +39,8 @@ static inline void gicc_init()
 
     gich->HCR |= GICH_HCR_LRENPIE_BIT;
     
-    uint32_t sgi_targets = gicd->ITARGETSR[0] & BIT32_MASK(0, GIC_TARGET_BITS);
+    bitmap_granule_t sgi_targets =
+        gicd->ITARGETSR[0] & BIT32_MASK(0, GIC_TARGET_BITS);
     ssize_t gic_cpu_id = 
         bitmap_find_nth((bitmap_t*)&sgi_targets, GIC_TARGET_BITS, 1, 0, true);
     if(gic_cpu_id < 0) {
@@ -144,6 +145,17 @@ static inline uint8_t gic_translate_cpu_to_trgt(uint8_t cpu_targets) {
     return gic_targets;
 }
 
+void gic_send_sgi_mask(cpumap_t cpu_targets, irqid_t sgi_num)
+{
+    uint8_t gic_targets = gic_translate_cpu_to_trgt(cpu_targets);
+
+    if (sgi_num < GIC_MAX_SGIS && gic_targets != 0) {
+        gicd->SGIR = 
+            ((uint32_t)gic_targets << GICD_SGIR_CPUTRGLST_OFF) |
+            (sgi_num & GICD_SGIR_SGIINTID_MSK);
+    }
+}
+
 void gicd_set_trgt(irqid_t int_id, uint8_t cpu_targets)
 {
     size_t reg_ind = GIC_TARGET_REG(int_id);
@@ -228,6 +228,42 @@ void gic_send_sgi(cpuid_t cpu_target, irqid_t sgi_num)
     }
 }
 
+void gic_send_sgi_mask(cpumap_t cpu_targets, irqid_t sgi_num)
+{
+    if (sgi_num >= GIC_MAX_SGIS) return;
+
+    /**
+     * A single write to ICC_SGI1R can target any subset of the cpus sharing
+     * the same aff1 value. Issue one write per affinity cluster present in
+     * the target mask.
+     */
+    while (cpu_targets != 0) {
+        unsigned long aff1 = 0;
+        uint64_t trglst = 0;
+        bool first = true;
+
+        for (cpuid_t cpu = 0; cpu < PLAT_CPU_NUM; cpu++) {
+            if (!(cpu_targets & (1UL << cpu))) continue;
+            unsigned long mpidr = cpu_id_to_mpidr(cpu) & MPIDR_AFF_MSK;
+            if (first) {
+                aff1 = MPIDR_AFF_LVL(mpidr, 1);
+                first = false;
+            }
+            if (MPIDR_AFF_LVL(mpidr, 1) == aff1) {
+                trglst |= (1UL << MPIDR_AFF_LVL(mpidr, 0));
+                cpu_targets &= ~(1UL << cpu);
+            }
+        }
+
+        if (first) break;
+
+        uint64_t sgi = (aff1 << ICC_SGIR_AFF1_OFFSET) |
+                       (trglst & ICC_SGIR_TRGLSTFLT_MSK) |
+                       (sgi_num << ICC_SGIR_SGIINTID_OFF);
+        sysreg_icc_sgi1r_el1_write(sgi);
+    }
+}
+
 void gic_set_prio(irqid_t int_id, uint8_t prio)
 {
     if (!gic_is_priv(int_id)) {
@@ -0,0 +1,130 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_MEMGUARD_H__
+#define __ARCH_MEMGUARD_H__
+
+#include <bao.h>
+#include <arch/sysregs.h>
+#include <arch/fences.h>
+
+/* PMU overflow and non-secure EL2 physical timer PPIs (SBSA defaults) */
+#ifndef MEMGUARD_ARCH_PMU_IRQ
+#define MEMGUARD_ARCH_PMU_IRQ (23)
+#endif
+
+#ifndef MEMGUARD_ARCH_TIMER_IRQ
+#define MEMGUARD_ARCH_TIMER_IRQ (26)
+#endif
+
+/* event counters are 32 bits wide */
+#define MEMGUARD_ARCH_BUDGET_MAX (0xffffffffUL)
+
+/**
+ * The hypervisor takes the last event counter. MDCR_EL2.HPMN hides it from
+ * the guest, whose PMCR.E and PMCR.P no longer reach it.
+ */
+static inline size_t memguard_arch_counter()
+{
+    return bit_extract(sysreg_pmcr_el0_read(), PMCR_N_OFF, PMCR_N_LEN) - 1;
+}
+
+/**
+ * PMSELR is shared with the guest, so it is restored after selecting the
+ * hypervisor's counter.
+ */
+static inline void memguard_arch_counter_write(unsigned long val, bool type)
+{
+    unsigned long pmselr = sysreg_pmselr_el0_read();
+
+    sysreg_pmselr_el0_write(memguard_arch_counter());
+    ISB();
+    if (type) {
+        sysreg_pmxevtyper_el0_write(val);
+    } else {
+        sysreg_pmxevcntr_el0_write(val);
+    }
+    sysreg_pmselr_el0_write(pmselr);
+    ISB();
+}
+
+static inline unsigned long memguard_arch_counter_read()
+{
+    unsigned long pmselr = sysreg_pmselr_el0_read();
+    unsigned long val;
+
+    sysreg_pmselr_el0_write(memguard_arch_counter());
+    ISB();
+    val = sysreg_pmxevcntr_el0_read();
+    sysreg_pmselr_el0_write(pmselr);
+    ISB();
+
+    return val;
+}
+
+static inline bool memguard_arch_init(enum memguard_event event)
+{
+    size_t num = bit_extract(sysreg_pmcr_el0_read(), PMCR_N_OFF, PMCR_N_LEN);
+
+    if (num == 0) {
+        return false;
+    }
+
+    unsigned long mdcr = sysreg_mdcr_el2_read();
+    mdcr = bit_insert(mdcr, num - 1, MDCR_HPMN_OFF, MDCR_HPMN_LEN);
+    sysreg_mdcr_el2_write(mdcr | MDCR_HPME);
+    ISB();
+
+    /* only count while the guest runs, i.e., at EL1 and EL0 */
+    memguard_arch_counter_write((event == MEMGUARD_EV_BUS_ACCESS) ?
+                                    PMEVTYPER_BUS_ACCESS :
+                                    PMEVTYPER_L2D_CACHE_REFILL, true);
+    sysreg_pmintenset_el1_write(1UL << (num - 1));
+
+    return true;
+}
+
+/* Counts from zero, overflowing after budget events */
+static inline void memguard_arch_start(size_t budget)
+{
+    size_t ctr = memguard_arch_counter();
+
+    sysreg_pmcntenclr_el0_write(1UL << ctr);
+    ISB();
+    memguard_arch_counter_write((uint32_t)(0 - budget), false);
+    sysreg_pmovsclr_el0_write(1UL << ctr);
+    sysreg_pmcntenset_el0_write(1UL << ctr);
+    ISB();
+}
+
+/* Events since memguard_arch_start(budget) */
+static inline size_t memguard_arch_count(size_t budget)
+{
+    return (uint32_t)(memguard_arch_counter_read() + budget);
+}
+
+/* Acknowledges the hypervisor counter's overflow, if it did */
+static inline bool memguard_arch_overflow()
+{
+    unsigned long bit = 1UL << memguard_arch_counter();
+
+    if (!(sysreg_pmovsclr_el0_read() & bit)) {
+        return false;
+    }
+
+    sysreg_pmovsclr_el0_write(bit);
+    ISB();
+
+    return true;
+}
+
+static inline void memguard_arch_timer_set(uint64_t deadline)
+{
+    sysreg_cnthp_cval_el2_write(deadline);
+    sysreg_cnthp_ctl_el2_write(CNTHP_CTL_ENABLE);
+    ISB();
+}
+
+#endif /* __ARCH_MEMGUARD_H__ */
@@ -16,6 +16,11 @@
 #define ID_AA64MMFR0_PAR_MSK \
     BIT64_MASK(ID_AA64MMFR0_PAR_OFF, ID_AA64MMFR0_PAR_LEN)
 
+/* ID_AA64ISAR0_EL1, AArch64 Instruction Set Attribute Register 0 */
+#define ID_AA64ISAR0_TLB_OFF 56
+#define ID_AA64ISAR0_TLB_LEN 4
+#define ID_AA64ISAR0_TLB_RANGE 2
+
 #define PAR_32BIT   (0)
 
 #define SPSel_SP (1 << 0)
@@ -427,6 +432,30 @@
 #define VSCTLR_EL2_VMID_OFF (REG_LENGTH - VSCTLR_EL2_VMID_OFF_ADJUST)
 #define VSCTLR_EL2_VMID_MSK BIT_MASK (VSCTLR_EL2_VMID_OFF, VSCTLR_EL2_VMID_LEN)
 
+/* PMCR - Performance Monitors Control Register */
+
+#define PMCR_E (1UL << 0)
+#define PMCR_N_OFF (11)
+#define PMCR_N_LEN (5)
+
+/* PMEVTYPER - Performance Monitors Event Type Register */
+
+#define PMEVTYPER_EVT_MSK (0xffffUL)
+#define PMEVTYPER_L2D_CACHE_REFILL (0x17)
+#define PMEVTYPER_BUS_ACCESS (0x19)
+
+/* MDCR_EL2 - Monitor Debug Configuration Register (EL2) */
+
+#define MDCR_HPMN_OFF (0)
+#define MDCR_HPMN_LEN (5)
+#define MDCR_HPME (1UL << 7)
+
+/* CNTHP_CTL - Hypervisor Physical Timer Control register */
+
+#define CNTHP_CTL_ENABLE (1UL << 0)
+#define CNTHP_CTL_IMASK (1UL << 1)
+#define CNTHP_CTL_ISTATUS (1UL << 2)
+
 /* GICC System Register Interface Definitions */
 
 #define ICC_PMR_EL1         S3_0_C4_C6_0           
@@ -0,0 +1,24 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_TIMER_H__
+#define __ARCH_TIMER_H__
+
+#include <bao.h>
+#include <arch/sysregs.h>
+#include <arch/fences.h>
+
+static inline uint64_t timer_arch_get()
+{
+    ISB();
+    return sysreg_cntpct_el0_read();
+}
+
+static inline uint64_t timer_arch_freq()
+{
+    return sysreg_cntfrq_el0_read();
+}
+
+#endif /* __ARCH_TIMER_H__ */
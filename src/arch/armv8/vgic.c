@@ -17,10 +17,12 @@
 
 #include <bit.h>
 #include <spinlock.h>
+#include <atomic.h>
 #include <cpu.h>
 #include <interrupts.h>
 #include <vm.h>
 #include <platform.h>
+#include <trace.h>
 
 enum VGIC_EVENTS { VGIC_UPDATE_ENABLE, VGIC_ROUTE, VGIC_INJECT, VGIC_SET_REG };
 extern volatile const size_t VGIC_IPI_ID;
@@ -129,15 +131,69 @@ void vgic_yield_ownership(struct vcpu *vcpu, struct vgic_int *interrupt)
     interrupt->owner = NULL;
 }
 
+/**
+ * Sources, one bit per vcpu, of the sgis sent to each cpu whose VGIC_INJECT
+ * message was not handled yet. Making an sgi pending is idempotent, so a
+ * new one from the same source rides on the message already in flight. This
+ * bounds the sgi messages a guest can queue on a cpu, however fast it sends.
+ */
+static volatile unsigned long vgic_sgi_inflight[PLAT_CPU_NUM][GIC_MAX_SGIS];
+
+static inline unsigned long vgic_sgi_src_bit(vcpuid_t source)
+{
+    /* gicv3 does not track sgis by source */
+    return GIC_VERSION == GICV2 ? (1UL << source) : 1UL;
+}
+
+/* Returns false if the sgi was already in flight to cpu */
+static bool vgic_sgi_inflight_set(cpuid_t cpu, irqid_t int_id, vcpuid_t source)
+{
+    volatile unsigned long *inflight = &vgic_sgi_inflight[cpu][int_id];
+    unsigned long bit = vgic_sgi_src_bit(source);
+    unsigned long val;
+
+    do {
+        val = atomic_load_acq(inflight);
+        if (val & bit) {
+            return false;
+        }
+    } while (!atomic_cas(inflight, val, val | bit));
+
+    return true;
+}
+
+static void vgic_sgi_inflight_clear(irqid_t int_id, vcpuid_t source)
+{
+    volatile unsigned long *inflight = &vgic_sgi_inflight[cpu()->id][int_id];
+    unsigned long bit = vgic_sgi_src_bit(source);
+    unsigned long val;
+
+    do {
+        val = atomic_load_acq(inflight);
+    } while (!atomic_cas(inflight, val, val & ~bit));
+}
+
 void vgic_send_sgi_msg(struct vcpu *vcpu, cpumap_t pcpu_mask, irqid_t int_id)
 {
     struct cpu_msg msg = {
         VGIC_IPI_ID, VGIC_INJECT,
         VGIC_MSG_DATA(cpu()->vcpu->vm->id, 0, int_id, 0, cpu()->vcpu->id)};
 
-    for (size_t i = 0; i < platform.cpu_num; i++) {
-        if (pcpu_mask & (1ull << i)) {
-            cpu_send_msg(i, &msg);
+    for (cpuid_t pcpu = 0; pcpu < PLAT_CPU_NUM; pcpu++) {
+        if (!(pcpu_mask & (1UL << pcpu)) ||
+            !vgic_sgi_inflight_set(pcpu, int_id, cpu()->vcpu->id)) {
+            continue;
+        }
+
+        /**
+         * If the target queue is full, serve this cpu's own queue while
+         * waiting, as the target might itself be waiting on it. This is safe
+         * here, as sgis are sent from a guest trap with no lock held.
+         */
+        while (!cpu_try_send_msg(pcpu, &msg)) {
+            if (!cpu()->handling_msgs) {
+                cpu_msg_handler();
+            }
         }
     }
 }
@@ -159,11 +215,7 @@ void vgic_route(struct vcpu *vcpu, struct vgic_int *interrupt)
         vgic_yield_ownership(vcpu, interrupt);
         cpumap_t trgtlist =
             vgic_int_ptarget_mask(vcpu, interrupt) & ~(1ull << vcpu->phys_id);
-        for (size_t i = 0; i < platform.cpu_num; i++) {
-            if (trgtlist & (1ull << i)) {
-                cpu_send_msg(i, &msg);
-            }
-        }
+        cpu_send_msg_mask(trgtlist, &msg);
     }
 }
 
@@ -301,6 +353,7 @@ void vgic_spill_lr(struct vcpu *vcpu, unsigned lr_ind) {
     struct vgic_int *spilled_int = vgic_get_int(vcpu, GICH_LR_VID(lr), vcpu->id);
 
     if (spilled_int != NULL) {
+        trace_event(TRACE_EV_VGIC_SPILL, spilled_int->id, lr_ind);
         spin_lock(&spilled_int->lock);
         vgic_remove_lr(vcpu, spilled_int);
         vgic_add_spilled(vcpu, spilled_int);
@@ -957,6 +1010,8 @@ void vgic_ipi_handler(uint32_t event, uint64_t data)
         } break;
 
         case VGIC_INJECT: {
+            /* cleared first, so a later sgi is either merged or resent */
+            vgic_sgi_inflight_clear(int_id, val);
             vgic_inject(cpu()->vcpu, int_id, val);
         } break;
 
@@ -1018,6 +1073,7 @@ static void vgic_refill_lrs(struct vcpu *vcpu, bool npie) {
             if(got_ownership) {
                 list_rm(list, &irq->node);
                 vgic_write_lr(vcpu, irq, lr_ind);
+                trace_event(TRACE_EV_VGIC_REFILL, irq->id, lr_ind);
             }
             spin_unlock(&irq->lock);
             if(!got_ownership) { continue; }
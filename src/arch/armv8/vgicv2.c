@@ -151,6 +151,7 @@ void vgic_init(struct vm *vm, const struct vgic_dscrp *vgic_dscrp)
     for (size_t i = 0; i < vm->arch.vgicd.int_num; i++) {
         vm->arch.vgicd.interrupts[i].owner = NULL;
         vm->arch.vgicd.interrupts[i].lock = SPINLOCK_INITVAL;
+        spin_lock_name(&vm->arch.vgicd.interrupts[i].lock, "vgic_int");
         vm->arch.vgicd.interrupts[i].id = i + GIC_CPU_PRIV;
         vm->arch.vgicd.interrupts[i].state = INV;
         vm->arch.vgicd.interrupts[i].prio = GIC_LOWEST_PRIO;
@@ -170,6 +171,7 @@ void vgic_init(struct vm *vm, const struct vgic_dscrp *vgic_dscrp)
 
     list_init(&vm->arch.vgic_spilled);
     vm->arch.vgic_spilled_lock = SPINLOCK_INITVAL;
+    spin_lock_name(&vm->arch.vgic_spilled_lock, "vgic_spilled");
 }
 
 void vgic_cpu_init(struct vcpu *vcpu)
@@ -177,6 +179,7 @@ void vgic_cpu_init(struct vcpu *vcpu)
     for (size_t i = 0; i < GIC_CPU_PRIV; i++) {
         vcpu->arch.vgic_priv.interrupts[i].owner = vcpu;
         vcpu->arch.vgic_priv.interrupts[i].lock = SPINLOCK_INITVAL;
+        spin_lock_name(&vcpu->arch.vgic_priv.interrupts[i].lock, "vgic_int");
         vcpu->arch.vgic_priv.interrupts[i].id = i;
         vcpu->arch.vgic_priv.interrupts[i].state = INV;
         vcpu->arch.vgic_priv.interrupts[i].prio = GIC_LOWEST_PRIO;
@@ -0,0 +1,82 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_ATOMIC_H__
+#define __ARCH_ATOMIC_H__
+
+#include <bao.h>
+
+static inline unsigned long atomic_load_acq(volatile unsigned long* ptr)
+{
+    unsigned long val;
+
+    asm volatile("ld %0, %1\n\t"
+                 "fence r, rw\n\t"
+                 : "=r"(val) : "m"(*ptr) : "memory");
+
+    return val;
+}
+
+static inline void atomic_store_rel(volatile unsigned long* ptr,
+                                    unsigned long val)
+{
+    asm volatile("fence rw, w\n\t"
+                 "sd %1, %0\n\t"
+                 : "=m"(*ptr) : "r"(val) : "memory");
+}
+
+static inline unsigned long atomic_fetch_add(volatile unsigned long* ptr,
+                                             unsigned long val)
+{
+    unsigned long old;
+
+    asm volatile("amoadd.d.aqrl %0, %2, %1\n\t"
+                 : "=r"(old), "+A"(*ptr)
+                 : "r"(val) : "memory");
+
+    return old;
+}
+
+static inline unsigned long atomic_swap(volatile unsigned long* ptr,
+                                        unsigned long val)
+{
+    unsigned long old;
+
+    asm volatile("amoswap.d.aqrl %0, %2, %1\n\t"
+                 : "=r"(old), "+A"(*ptr)
+                 : "r"(val) : "memory");
+
+    return old;
+}
+
+static inline bool atomic_cas(volatile unsigned long* ptr, unsigned long expected,
+                              unsigned long desired)
+{
+    unsigned long old;
+    unsigned long fail;
+
+    asm volatile("1:\n\t"
+                 "lr.d.aqrl  %0, %2 \n\t"
+                 "bne        %0, %3, 2f \n\t"
+                 "sc.d.rl    %1, %4, %2 \n\t"
+                 "bnez       %1, 1b \n\t"
+                 "2:\n\t"
+                 : "=&r"(old), "=&r"(fail), "+A"(*ptr)
+                 : "r"(expected), "r"(desired) : "memory");
+
+    return old == expected;
+}
+
+static inline unsigned long atomic_wait_neq(volatile unsigned long* ptr,
+                                            unsigned long old)
+{
+    unsigned long val;
+
+    while ((val = atomic_load_acq(ptr)) == old);
+
+    return val;
+}
+
+#endif /* __ARCH_ATOMIC_H__ */
@@ -0,0 +1,39 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_MEMGUARD_H__
+#define __ARCH_MEMGUARD_H__
+
+#include <bao.h>
+
+/**
+ * Neither the hpm counters' overflow interrupt (Sscofpmf) nor a hypervisor
+ * timer separate from the guest's are used yet, so regulation is never
+ * enabled and the interrupt ids below are never reserved.
+ */
+#define MEMGUARD_ARCH_PMU_IRQ (0)
+#define MEMGUARD_ARCH_TIMER_IRQ (0)
+#define MEMGUARD_ARCH_BUDGET_MAX (0)
+
+static inline bool memguard_arch_init(enum memguard_event event)
+{
+    return false;
+}
+
+static inline void memguard_arch_start(size_t budget) { }
+
+static inline size_t memguard_arch_count(size_t budget)
+{
+    return 0;
+}
+
+static inline bool memguard_arch_overflow()
+{
+    return false;
+}
+
+static inline void memguard_arch_timer_set(uint64_t deadline) { }
+
+#endif /* __ARCH_MEMGUARD_H__ */
@@ -8,14 +8,60 @@
 
 #include <bao.h>
 
-typedef volatile uint32_t __attribute__((aligned(4))) spinlock_t;
+typedef volatile uint32_t __attribute__((aligned(4))) raw_spinlock_t;
 
-#define SPINLOCK_INITVAL (0)
+#define RAW_SPINLOCK_INITVAL (0)
 
-static inline void spin_lock(spinlock_t* lock)
+#ifdef SPINLOCK_TICKET
+
+/**
+ * Ticket lock. The upper half of the lock word holds the next ticket to be
+ * handed out, the lower half the ticket currently being served.
+ */
+
+static inline bool raw_spin_is_locked(raw_spinlock_t* lock)
+{
+    uint32_t val = *lock;
+    return (val >> 16) != (val & 0xffff);
+}
+
+static inline void raw_spin_lock(raw_spinlock_t* lock)
+{
+    uint32_t const TICKET_INC = (1 << 16);
+    uint32_t val;
+
+    asm volatile("amoadd.w.aq %0, %2, %1\n\t"
+                 : "=r"(val), "+A"(*lock)
+                 : "r"(TICKET_INC) : "memory");
+
+    uint32_t ticket = val >> 16;
+    while ((val & 0xffff) != ticket) {
+        val = *(volatile uint16_t*)lock;
+    }
+
+    asm volatile("fence r, rw\n\t" ::: "memory");
+}
+
+static inline void raw_spin_unlock(raw_spinlock_t* lock)
 {
-    spinlock_t const ONE = 1;
-    spinlock_t tmp = SPINLOCK_INITVAL;
+    uint16_t owner = *(volatile uint16_t*)lock + 1;
+
+    asm volatile("fence rw, w\n\t"
+                 "sh %1, %0\n\t"
+                 : "=m"(*(volatile uint16_t*)lock) : "r"(owner) : "memory");
+}
+
+#else
+
+static inline bool raw_spin_is_locked(raw_spinlock_t* lock)
+{
+    return *lock != 0;
+}
+
+static inline void raw_spin_lock(raw_spinlock_t* lock)
+{
+    raw_spinlock_t const ONE = 1;
+    raw_spinlock_t tmp = RAW_SPINLOCK_INITVAL;
 
     asm volatile("1:\n\t"
                  "lr.w.aq  %0, %1 \n\t"
@@ -26,11 +72,13 @@ static inline void spin_lock(spinlock_t* lock)
                  : "r"(ONE) : "memory");
 }
 
-static inline void spin_unlock(spinlock_t* lock)
+static inline void raw_spin_unlock(raw_spinlock_t* lock)
 {
     asm volatile("sw zero, %0\n\t"
                  "fence rw, rw\n\t"  // Is the full blown barrier really needed?
                  ::"m"(*lock) : "memory");
 }
 
+#endif /* SPINLOCK_TICKET */
+
 #endif /* __ARCH_SPINLOCK__ */
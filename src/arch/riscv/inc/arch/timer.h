@@ -0,0 +1,23 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_TIMER_H__
+#define __ARCH_TIMER_H__
+
+#include <bao.h>
+#include <arch/csrs.h>
+
+static inline uint64_t timer_arch_get()
+{
+    return CSRR(time);
+}
+
+/* The timebase frequency is not described by the platform */
+static inline uint64_t timer_arch_freq()
+{
+    return 0;
+}
+
+#endif /* __ARCH_TIMER_H__ */
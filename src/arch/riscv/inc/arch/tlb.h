@@ -10,6 +10,12 @@
 #include <platform.h>
 #include <arch/sbi.h>
 
+/**
+ * Without Svvptc a hart might have cached an entry while it was still
+ * invalid, so new mappings must be fenced as well.
+ */
+#define TLB_ARCH_CACHES_INVALID (true)
+
 /**
  * TODO: we are assuming platform.cpu_num is power of two. Make this not true.
  */
@@ -25,6 +31,28 @@ static inline void tlb_hyp_inv_all()
     sbi_remote_sfence_vma((1 << platform.cpu_num) - 1, 0, 0, 0);
 }
 
+static inline void tlb_hyp_inv_range(vaddr_t va, size_t size, size_t stride)
+{
+    sbi_remote_sfence_vma((1 << platform.cpu_num) - 1, 0, (unsigned long)va,
+                          size);
+}
+
+static inline void tlb_hyp_inv_va_local(vaddr_t va)
+{
+    asm volatile("sfence.vma %0, zero" ::"r"(va) : "memory");
+}
+
+static inline void tlb_hyp_inv_all_local()
+{
+    asm volatile("sfence.vma" ::: "memory");
+}
+
+/* the SBI takes whole ranges, leaving the flush strategy to the firmware */
+static inline bool tlb_arch_range(size_t size)
+{
+    return true;
+}
+
 /**
  * TODO: change hart_mask to only take into account the vm physical cpus.
  */
@@ -40,4 +68,11 @@ static inline void tlb_vm_inv_all(asid_t vmid)
     sbi_remote_hfence_gvma_vmid((1 << platform.cpu_num) - 1, 0, 0, 0, vmid);
 }
 
+static inline void tlb_vm_inv_range(asid_t vmid, vaddr_t va, size_t size,
+                                    size_t stride)
+{
+    sbi_remote_hfence_gvma_vmid((1 << platform.cpu_num) - 1, 0,
+                                (unsigned long)va, size, vmid);
+}
+
 #endif /* __ARCH_TLB_H__ */
@@ -8,7 +8,7 @@
 
 #include <bao.h>
 #include <arch/plic.h>
-#include <arch/spinlock.h>
+#include <spinlock.h>
 #include <bitmap.h>
 #include <emul.h>
 
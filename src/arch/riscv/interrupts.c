@@ -46,6 +46,11 @@ void interrupts_arch_ipi_send(cpuid_t target_cpu, irqid_t ipi_id)
     sbi_send_ipi(1ULL << target_cpu, 0);
 }
 
+void interrupts_arch_ipi_send_mask(cpumap_t cpu_targets, irqid_t ipi_id)
+{
+    sbi_send_ipi(cpu_targets, 0);
+}
+
 void interrupts_arch_cpu_enable(bool en)
 {
     if (en) {
@@ -23,3 +23,8 @@ bool iommu_arch_vm_init(struct vm *vm, const struct vm_config *config)
 {
     return true;
 }
+
+bool iommu_arch_vm_has_devices(struct vm *vm)
+{
+    return false;
+}
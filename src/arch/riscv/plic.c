@@ -6,6 +6,7 @@
 #include <arch/plic.h>
 #include <interrupts.h>
 #include <cpu.h>
+#include <trace.h>
 
 size_t PLIC_IMPL_INTERRUPTS;
 
@@ -126,6 +127,7 @@ void plic_handle()
     uint32_t id = plic_hart[cpu()->arch.plic_cntxt].claim;
 
     if (id != 0) {
+        trace_event(TRACE_EV_IRQ, id, 0);
         enum irq_res res = interrupts_handle(id);
         if (res == HANDLED_BY_HYP) plic_hart[cpu()->arch.plic_cntxt].complete = id;
     }
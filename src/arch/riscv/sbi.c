@@ -9,6 +9,7 @@
 #include <vm.h>
 #include <bitmap.h>
 #include <fences.h>
+#include <atomic.h>
 #include <hypercall.h>
 
 #define SBI_EXTID_BASE (0x10)
@@ -204,10 +205,20 @@ enum SBI_MSG_EVENTS { SEND_IPI, HART_START };
 void sbi_msg_handler(uint32_t event, uint64_t data);
 CPU_MSG_HANDLER(sbi_msg_handler, SBI_MSG_ID);
 
+/**
+ * Whether a SEND_IPI message to each cpu was not handled yet. Raising the
+ * software interrupt is idempotent, so a new ipi rides on the message
+ * already in flight. This bounds the ipi messages a guest can queue on a
+ * cpu, however fast it sends.
+ */
+static volatile unsigned long sbi_ipi_inflight[PLAT_CPU_NUM];
+
 void sbi_msg_handler(uint32_t event, uint64_t data)
 {
     switch (event) {
         case SEND_IPI:
+            /* cleared first, so a later ipi is either merged or resent */
+            atomic_store_rel(&sbi_ipi_inflight[cpu()->id], 0);
             CSRS(CSR_HVIP, HIP_VSSIP);
             break;
         case HART_START: {
@@ -255,12 +266,31 @@ struct sbiret sbi_ipi_handler(unsigned long fid)
         .handler = SBI_MSG_ID,
         .event = SEND_IPI,
     };
+    cpumap_t phart_mask = 0;
 
     for (size_t i = 0; i < sizeof(hart_mask) * 8; i++) {
         if (bitmap_get((bitmap_t*)&hart_mask, i)) {
             vcpuid_t vhart_id = hart_mask_base + i;
             cpuid_t phart_id = vm_translate_to_pcpuid(cpu()->vcpu->vm, vhart_id);
-            if(phart_id != INVALID_CPUID) cpu_send_msg(phart_id, &msg);
+            if(phart_id != INVALID_CPUID) phart_mask |= (1UL << phart_id);
+        }
+    }
+
+    for (cpuid_t phart_id = 0; phart_id < PLAT_CPU_NUM; phart_id++) {
+        if (!(phart_mask & (1UL << phart_id)) ||
+            !atomic_cas(&sbi_ipi_inflight[phart_id], 0, 1)) {
+            continue;
+        }
+
+        /**
+         * If the target queue is full, serve this hart's own queue while
+         * waiting, as the target might itself be waiting on it. This is safe
+         * here, as no lock is held while handling the sbi call.
+         */
+        while (!cpu_try_send_msg(phart_id, &msg)) {
+            if (!cpu()->handling_msgs) {
+                cpu_msg_handler();
+            }
         }
     }
 
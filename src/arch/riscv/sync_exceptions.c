@@ -9,6 +9,7 @@
 #include <arch/encoding.h>
 #include <arch/csrs.h>
 #include <arch/instructions.h>
+#include <trace.h>
 
 void internal_exception_handler(unsigned long gprs[]) {
 
@@ -150,6 +151,8 @@ void sync_exception_handler()
         internal_exception_handler(&cpu()->vcpu->regs.x[0]);
     }
 
+    trace_event(TRACE_EV_SYNC_EXCP, _scause, cpu()->vcpu->regs.sepc);
+
     // TODO: Do we need to check call comes from VS-mode and not VU-mode
     // or U-mode ?
 
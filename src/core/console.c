@@ -14,7 +14,7 @@
 
 volatile bao_uart_t *uart;
 bool ready = false;
-static spinlock_t print_lock = SPINLOCK_INITVAL;
+static spinlock_t print_lock = SPINLOCK_NAMED_INITVAL("print_lock");
 
 void console_init()
 {
@@ -6,21 +6,33 @@
 #include <cpu.h>
 #include <interrupts.h>
 #include <platform.h>
-#include <objpool.h>
 #include <vm.h>
 #include <fences.h>
+#include <atomic.h>
+#include <objpool.h>
+#include <timer.h>
+#include <trace.h>
 
-struct cpu_msg_node {
-    node_t node;
-    struct cpu_msg msg;
+#define CPU_MSG_QUEUE_MASK (CPU_MSG_QUEUE_SIZE - 1)
+
+struct cpu_call {
+    cpu_call_fn_t fn;
+    void* arg;
+    volatile unsigned long pending;
+    volatile unsigned long refs;
+    volatile bool done[PLAT_CPU_NUM];
+    long ret[PLAT_CPU_NUM];
 };
 
-#define CPU_MSG_POOL_SIZE_DEFAULT (128)
-#ifndef CPU_MSG_POOL_SIZE
-#define CPU_MSG_POOL_SIZE CPU_MSG_POOL_SIZE_DEFAULT
+#define CPU_CALL_POOL_SIZE_DEFAULT (2 * PLAT_CPU_NUM)
+#ifndef CPU_CALL_POOL_SIZE
+#define CPU_CALL_POOL_SIZE CPU_CALL_POOL_SIZE_DEFAULT
 #endif
 
-OBJPOOL_ALLOC(msg_pool, struct cpu_msg_node, CPU_MSG_POOL_SIZE);
+OBJPOOL_ALLOC(cpu_call_pool, struct cpu_call, CPU_CALL_POOL_SIZE);
+
+static void cpu_call_handler(uint32_t event, uint64_t data);
+CPU_MSG_HANDLER(cpu_call_handler, CPU_CALL_MSG_ID);
 
 struct cpu_synctoken cpu_glb_sync = {.ready = false};
 
@@ -31,6 +43,80 @@ size_t ipi_cpumsg_handler_num;
 
 struct cpuif cpu_interfaces[PLAT_CPU_NUM];
 
+static void cpu_msg_queue_init(struct cpu_msg_queue* queue)
+{
+    queue->head = 0;
+    queue->tail = 0;
+    for (size_t i = 0; i < CPU_MSG_QUEUE_SIZE; i++) {
+        queue->slots[i].seq = i;
+    }
+    fence_ord_write();
+}
+
+static bool cpu_msg_enqueue(struct cpu_msg_queue* queue, struct cpu_msg* msg)
+{
+    struct cpu_msg_slot* slot = NULL;
+    unsigned long pos = atomic_load_acq(&queue->head);
+
+    while (true) {
+        slot = &queue->slots[pos & CPU_MSG_QUEUE_MASK];
+        long diff = (long)(atomic_load_acq(&slot->seq) - pos);
+        if (diff == 0) {
+            if (atomic_cas(&queue->head, pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* the consumer has not yet released this slot: queue is full */
+            return false;
+        }
+        pos = atomic_load_acq(&queue->head);
+    }
+
+    slot->msg = *msg;
+    atomic_store_rel(&slot->seq, pos + 1);
+
+    return true;
+}
+
+static bool cpu_msg_dequeue(struct cpu_msg_queue* queue, struct cpu_msg* msg)
+{
+    unsigned long pos = queue->tail;
+    struct cpu_msg_slot* slot = &queue->slots[pos & CPU_MSG_QUEUE_MASK];
+
+    if (atomic_load_acq(&slot->seq) != (pos + 1)) {
+        return false;
+    }
+
+    *msg = slot->msg;
+    atomic_store_rel(&slot->seq, pos + CPU_MSG_QUEUE_SIZE);
+    queue->tail = pos + 1;
+
+    return true;
+}
+
+static inline bool cpu_msg_queue_empty(struct cpu_msg_queue* queue)
+{
+    unsigned long pos = queue->tail;
+    struct cpu_msg_slot* slot = &queue->slots[pos & CPU_MSG_QUEUE_MASK];
+
+    return atomic_load_acq(&slot->seq) != (pos + 1);
+}
+
+/**
+ * Returns true if the caller must raise the IPI on trgtcpu, i.e. if it is the
+ * first to publish a message since the target last drained its queue.
+ */
+static inline bool cpu_msg_ring_doorbell(cpuid_t trgtcpu)
+{
+    fence_ord();
+    if (atomic_cas(&cpu_if(trgtcpu)->doorbell, 0, 1)) {
+        cpu()->interface->ipi_sent++;
+        return true;
+    }
+    cpu()->interface->ipi_suppressed++;
+    return false;
+}
+
 void cpu_init(cpuid_t cpu_id, paddr_t load_addr)
 {
     cpu()->id = cpu_id;
@@ -39,7 +125,10 @@ void cpu_init(cpuid_t cpu_id, paddr_t load_addr)
 
     cpu_arch_init(cpu_id, load_addr);
 
-    list_init(&cpu()->interface->event_list);
+    cpu_msg_queue_init(&cpu()->interface->msg_queue);
+    cpu()->interface->doorbell = 0;
+    cpu()->interface->ipi_sent = 0;
+    cpu()->interface->ipi_suppressed = 0;
 
     if (cpu()->id == CPU_MASTER) {
         cpu_sync_init(&cpu_glb_sync, platform.cpu_num);
@@ -54,41 +143,255 @@ void cpu_init(cpuid_t cpu_id, paddr_t load_addr)
     cpu_sync_barrier(&cpu_glb_sync);
 }
 
+bool cpu_try_send_msg(cpuid_t trgtcpu, struct cpu_msg *msg)
+{
+    if (!cpu_msg_enqueue(&cpu_if(trgtcpu)->msg_queue, msg)) {
+        return false;
+    }
+    if (cpu_msg_ring_doorbell(trgtcpu)) {
+        fence_sync_write();
+        interrupts_cpu_sendipi(trgtcpu, IPI_CPU_MSG);
+    }
+    return true;
+}
+
 void cpu_send_msg(cpuid_t trgtcpu, struct cpu_msg *msg)
 {
-    struct cpu_msg_node *node = objpool_alloc(&msg_pool);
-    if (node == NULL) ERROR("cant allocate msg node");
-    node->msg = *msg;
-    list_push(&cpu_if(trgtcpu)->event_list, (node_t *)node);
-    fence_sync_write();
-    interrupts_cpu_sendipi(trgtcpu, IPI_CPU_MSG);
+    while (!cpu_try_send_msg(trgtcpu, msg)) {
+        /**
+         * The target queue is full. Kick the target again in case it missed
+         * the previous notification and wait for it to drain. Our own
+         * handlers are not run here, as the caller might be holding locks
+         * they need. Guest driven ipis, which have no bound of their own,
+         * don't come through here: their senders coalesce them and serve
+         * their own queue while waiting.
+         */
+        interrupts_cpu_sendipi(trgtcpu, IPI_CPU_MSG);
+    }
 }
 
-bool cpu_get_msg(struct cpu_msg *msg)
+void cpu_send_msg_mask(cpumap_t trgtcpus, struct cpu_msg *msg)
 {
-    struct cpu_msg_node *node = NULL;
-    if ((node = (struct cpu_msg_node *)list_pop(&cpu()->interface->event_list)) !=
-        NULL) {
-        *msg = node->msg;
-        objpool_free(&msg_pool, node);
-        return true;
+    cpumap_t pending = trgtcpus;
+
+    while (pending != 0) {
+        cpumap_t notify = 0;
+
+        for (cpuid_t cpu = 0; cpu < PLAT_CPU_NUM; cpu++) {
+            if ((pending & (1UL << cpu)) &&
+                cpu_msg_enqueue(&cpu_if(cpu)->msg_queue, msg)) {
+                pending &= ~(1UL << cpu);
+                if (cpu_msg_ring_doorbell(cpu)) {
+                    notify |= (1UL << cpu);
+                }
+            }
+        }
+
+        if (notify != 0) {
+            fence_sync_write();
+            interrupts_cpu_sendipi_mask(notify, IPI_CPU_MSG);
+        }
+
+        if (pending != 0) {
+            /* Same backpressure policy as cpu_send_msg */
+            interrupts_cpu_sendipi_mask(pending, IPI_CPU_MSG);
+        }
     }
-    return false;
+}
+
+static void cpu_call_put(struct cpu_call *call)
+{
+    if (atomic_fetch_add(&call->refs, -1UL) == 1) {
+        objpool_free(&cpu_call_pool, call);
+    }
+}
+
+static void cpu_call_handler(uint32_t event, uint64_t data)
+{
+    struct cpu_call *call = (struct cpu_call *)(uintptr_t)data;
+
+    call->ret[cpu()->id] = call->fn(call->arg);
+    /* a caller that timed out reads ret only after seeing done */
+    fence_ord_write();
+    call->done[cpu()->id] = true;
+    atomic_fetch_add(&call->pending, -1UL);
+    cpu_call_put(call);
+}
+
+cpumap_t cpu_call_sync(cpumap_t targets, cpu_call_fn_t fn, void *arg,
+                       long *ret, uint64_t timeout)
+{
+    cpumap_t completed = 0;
+    cpumap_t remote = targets & ~(1UL << cpu()->id);
+    size_t n = 0;
+
+    for (cpuid_t cpu = 0; cpu < PLAT_CPU_NUM; cpu++) {
+        if (bit_get(remote, cpu)) n++;
+    }
+
+    struct cpu_call *call = NULL;
+    if (n > 0) {
+        call = objpool_alloc(&cpu_call_pool);
+        if (call == NULL) {
+            ERROR("cant allocate cpu call");
+        }
+        call->fn = fn;
+        call->arg = arg;
+        call->pending = n;
+        /* one reference per target plus the caller's */
+        call->refs = n + 1;
+        for (cpuid_t cpu = 0; cpu < PLAT_CPU_NUM; cpu++) {
+            call->done[cpu] = false;
+        }
+
+        struct cpu_msg msg = {CPU_CALL_MSG_ID, 0, (uintptr_t)call};
+        cpu_send_msg_mask(remote, &msg);
+    }
+
+    if (bit_get(targets, cpu()->id)) {
+        long val = fn(arg);
+        if (ret != NULL) ret[cpu()->id] = val;
+        completed |= (1UL << cpu()->id);
+    }
+
+    if (call == NULL) {
+        return completed;
+    }
+
+    uint64_t start = timer_get();
+    while (atomic_load_acq(&call->pending) != 0) {
+        /* targets might be waiting on us, keep handling our messages */
+        cpu_msg_handler();
+        if ((timeout != CPU_CALL_NO_TIMEOUT) &&
+            ((timer_get() - start) >= timeout)) {
+            break;
+        }
+    }
+    fence_ord_read();
+
+    for (cpuid_t cpu = 0; cpu < PLAT_CPU_NUM; cpu++) {
+        if (bit_get(remote, cpu) && call->done[cpu]) {
+            fence_ord_read();
+            if (ret != NULL) ret[cpu] = call->ret[cpu];
+            completed |= (1UL << cpu);
+        }
+    }
+
+    /* on timeout, the last target to run the call frees it */
+    cpu_call_put(call);
+
+    return completed;
+}
+
+bool cpu_get_msg(struct cpu_msg *msg)
+{
+    return cpu_msg_dequeue(&cpu()->interface->msg_queue, msg);
 }
 
 void cpu_msg_handler()
 {
+    /**
+     * Messages are fully dequeued before being dispatched, so this might
+     * nest when a handler itself waits on other cpus in cpu_call_sync.
+     */
+    bool handling_msgs = cpu()->handling_msgs;
+    struct cpuif* interface = cpu()->interface;
     cpu()->handling_msgs = true;
     struct cpu_msg msg;
-    while (cpu_get_msg(&msg)) {
-        if (msg.handler < ipi_cpumsg_handler_num &&
-            ipi_cpumsg_handlers[msg.handler]) {
-            ipi_cpumsg_handlers[msg.handler](msg.event, msg.data);
+    do {
+        while (cpu_get_msg(&msg)) {
+            if (msg.handler < ipi_cpumsg_handler_num &&
+                ipi_cpumsg_handlers[msg.handler]) {
+                trace_event(TRACE_EV_CPU_MSG, msg.handler, msg.event);
+                ipi_cpumsg_handlers[msg.handler](msg.event, msg.data);
+            }
         }
+        /**
+         * Re-arm the doorbell and look at the queue once more. A message
+         * published before the doorbell was cleared did not raise an IPI, so
+         * it must be picked up here unless a new sender already claimed the
+         * doorbell, in which case its IPI is on the way.
+         */
+        atomic_store_rel(&interface->doorbell, 0);
+        fence_ord();
+    } while (!cpu_msg_queue_empty(&interface->msg_queue) &&
+             atomic_cas(&interface->doorbell, 0, 1));
+    cpu()->handling_msgs = handling_msgs;
+}
+
+void cpu_msg_stats_dump()
+{
+    for (cpuid_t cpu = 0; cpu < platform.cpu_num; cpu++) {
+        struct cpuif* interface = cpu_if(cpu);
+        INFO("cpu %lu msg ipis sent %lu suppressed %lu", (unsigned long)cpu,
+             (unsigned long)interface->ipi_sent,
+             (unsigned long)interface->ipi_suppressed);
     }
-    cpu()->handling_msgs = false;
+    objpool_dump(&cpu_call_pool);
 }
 
+#ifdef BOOT_PROFILE
+
+#define CPU_SYNC_BENCH_ITERS (1000)
+
+/**
+ * Arrival times, double buffered by round parity: a cpu leaving a round can
+ * only write the other buffer until everyone arrives at the next one.
+ */
+static volatile uint64_t cpu_sync_bench_arrival[2][PLAT_CPU_NUM];
+static struct {
+    uint64_t total;
+    uint64_t max;
+} cpu_sync_bench_cpus[PLAT_CPU_NUM];
+
+void cpu_sync_bench()
+{
+    uint64_t total = 0;
+    uint64_t max = 0;
+
+    cpu_sync_barrier(&cpu_glb_sync);
+
+    for (size_t i = 0; i < CPU_SYNC_BENCH_ITERS; i++) {
+        volatile uint64_t* arrival = cpu_sync_bench_arrival[i & 1];
+
+        arrival[cpu()->id] = timer_get();
+        cpu_sync_barrier(&cpu_glb_sync);
+        uint64_t release = timer_get();
+
+        uint64_t last = 0;
+        for (size_t cpu = 0; cpu < platform.cpu_num; cpu++) {
+            if (arrival[cpu] > last) {
+                last = arrival[cpu];
+            }
+        }
+        uint64_t latency = release - last;
+        total += latency;
+        if (latency > max) {
+            max = latency;
+        }
+    }
+
+    cpu_sync_bench_cpus[cpu()->id].total = total;
+    cpu_sync_bench_cpus[cpu()->id].max = max;
+
+    cpu_sync_barrier(&cpu_glb_sync);
+
+    if (cpu()->id == CPU_MASTER) {
+        INFO("barrier on %lu cpus, %lu rounds, timer %lu Hz",
+             (unsigned long)platform.cpu_num,
+             (unsigned long)CPU_SYNC_BENCH_ITERS,
+             (unsigned long)timer_get_freq());
+        for (size_t cpu = 0; cpu < platform.cpu_num; cpu++) {
+            INFO("cpu %lu release avg %lu max %lu ticks", (unsigned long)cpu,
+                 (unsigned long)(cpu_sync_bench_cpus[cpu].total /
+                                 CPU_SYNC_BENCH_ITERS),
+                 (unsigned long)cpu_sync_bench_cpus[cpu].max);
+        }
+    }
+}
+
+#endif /* BOOT_PROFILE */
+
 void cpu_idle()
 {
     cpu_arch_idle();
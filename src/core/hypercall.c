@@ -7,6 +7,12 @@
 #include <cpu.h>
 #include <vm.h>
 #include <ipc.h>
+#include <spinlock.h>
+#include <mem.h>
+#include <trace.h>
+#include <vmm.h>
+#include <memguard.h>
+#include <config.h>
 
 long int hypercall(unsigned long id) {
     long int ret = -HC_E_INVAL_ID;
@@ -19,9 +25,39 @@ long int hypercall(unsigned long id) {
         case HC_IPC:
             ret = ipc_hypercall(ipc_id, arg1, arg2);
         break;
+        case HC_LOCK_STATS:
+            if (!cpu()->vcpu->vm->config->stats_ctl) {
+                ret = -HC_E_FAILURE;
+                break;
+            }
+            lock_stats_dump();
+            ret = HC_E_SUCCESS;
+        break;
+        case HC_MEM_STATS:
+            if (!cpu()->vcpu->vm->config->stats_ctl) {
+                ret = -HC_E_FAILURE;
+                break;
+            }
+            mem_page_cache_dump();
+            memguard_dump();
+            ret = HC_E_SUCCESS;
+        break;
+        case HC_VM_RECOLOR:
+            ret = vmm_recolor_hypercall(ipc_id, arg1, arg2);
+        break;
+        case HC_CPU_STATS:
+            if (!cpu()->vcpu->vm->config->stats_ctl) {
+                ret = -HC_E_FAILURE;
+                break;
+            }
+            cpu_msg_stats_dump();
+            ret = HC_E_SUCCESS;
+        break;
         default:
             WARNING("Unknown hypercall id %d", id);
     }
 
+    trace_event(TRACE_EV_HYPERCALL, id, ret);
+
     return ret;
 }
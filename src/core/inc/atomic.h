@@ -0,0 +1,11 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ATOMIC_H__
+#define __ATOMIC_H__
+
+#include <arch/atomic.h>
+
+#endif /* __ATOMIC_H__ */
@@ -10,6 +10,7 @@
 #include <platform.h>
 #include <vm.h>
 #include <config_defs.h>
+#include <memguard.h>
 
 
 #ifndef GENERATING_DEFS
@@ -89,6 +90,21 @@ struct vm_config {
      */
     colormap_t colors;
 
+    /**
+     * Allows the VM to change the colors of any VM, including itself, at
+     * runtime through the recolor hypercall.
+     */
+    bool recolor_ctl;
+
+    /* Allows the VM to dump the hypervisor's statistics through hypercalls */
+    bool stats_ctl;
+
+    /**
+     * Memory bandwidth budget of each of the VM's cpus. Once a cpu causes
+     * budget events within a period it is stalled until the next one.
+     */
+    struct memguard_config memguard;
+
     /**
      * A description of the virtual platform available to the guest, i.e.,
      * the virtual machine itself.
@@ -113,6 +129,14 @@ extern struct config {
 
         /* Hypervisor colors */
         colormap_t colors;
+
+        /**
+         * Only meaningful if built with TRACE=y. If set, the per-cpu trace
+         * rings are placed in shared memory region trace_shmem_id so a VM
+         * with an ipc to that region can read them.
+         */
+        bool trace_export;
+        size_t trace_shmem_id;
     } hyp;
 
     /* Definition of shared memory regions to be used by VMs */
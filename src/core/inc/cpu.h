@@ -12,11 +12,55 @@
 #include <spinlock.h>
 #include <mem.h>
 #include <list.h>
+#include <atomic.h>
+#include <fences.h>
 
 #ifndef __ASSEMBLER__
 
+#define CPU_MSG_QUEUE_SIZE_DEFAULT (64)
+#ifndef CPU_MSG_QUEUE_SIZE
+#define CPU_MSG_QUEUE_SIZE CPU_MSG_QUEUE_SIZE_DEFAULT
+#endif
+
+#if ((CPU_MSG_QUEUE_SIZE) & ((CPU_MSG_QUEUE_SIZE) - 1)) != 0
+#error "CPU_MSG_QUEUE_SIZE must be a power of two"
+#endif
+
+struct cpu_msg {
+    uint32_t handler;
+    uint32_t event;
+    uint64_t data;
+};
+
+/**
+ * Bounded multi-producer single-consumer ring. Each slot carries a sequence
+ * number: a slot at position pos is free for producers when seq == pos and
+ * holds a message ready for the consumer when seq == pos + 1. Producers claim
+ * a position by advancing head with a cas, only the owning cpu moves tail.
+ */
+struct cpu_msg_slot {
+    volatile unsigned long seq;
+    struct cpu_msg msg;
+};
+
+struct cpu_msg_queue {
+    volatile unsigned long head;
+    unsigned long tail;
+    struct cpu_msg_slot slots[CPU_MSG_QUEUE_SIZE];
+};
+
 struct cpuif {
-    struct list event_list;
+    struct cpu_msg_queue msg_queue;
+
+    /**
+     * Set by the first producer of a burst, which is the only one raising
+     * the IPI. Cleared by the owner cpu once its queue has been drained.
+     */
+    volatile unsigned long doorbell;
+
+    /* IPIs raised and elided by this cpu acting as a message sender */
+    size_t ipi_sent;
+    size_t ipi_suppressed;
 
 } __attribute__((aligned(PAGE_SIZE))) ;
 
@@ -38,13 +82,6 @@ struct cpu {
     uint8_t stack[STACK_SIZE] __attribute__((aligned(PAGE_SIZE)));
     
 } __attribute__((aligned(PAGE_SIZE)));
-struct cpu_msg {
-    uint32_t handler;
-    uint32_t event;
-    uint64_t data;
-};
-
-void cpu_send_msg(cpuid_t cpu, struct cpu_msg* msg);
 
 typedef void (*cpu_msg_handler_t)(uint32_t event, uint64_t data);
 
@@ -54,19 +91,48 @@ typedef void (*cpu_msg_handler_t)(uint32_t event, uint64_t data);
     __attribute__((section(".ipi_cpumsg_handlers_id"),          \
                    used)) volatile const size_t handler_id;
 
+/**
+ * Sense-reversing barrier. Instead of a per-cpu sense flag, each cpu samples
+ * the generation on arrival and waits for the last one to bump it.
+ */
 struct cpu_synctoken {
-    spinlock_t lock;
     volatile size_t n;
     volatile bool ready;
-    volatile size_t count;
+    volatile unsigned long count;
+    volatile unsigned long gen;
 };
 
 extern struct cpu_synctoken cpu_glb_sync;
 
 void cpu_init(cpuid_t cpu_id, paddr_t load_addr);
 void cpu_send_msg(cpuid_t cpu, struct cpu_msg* msg);
+bool cpu_try_send_msg(cpuid_t cpu, struct cpu_msg* msg);
+void cpu_send_msg_mask(cpumap_t cpus, struct cpu_msg* msg);
+
+typedef long (*cpu_call_fn_t)(void* arg);
+
+#define CPU_CALL_NO_TIMEOUT (0)
+
+/**
+ * Runs fn(arg) on every cpu in targets and waits for completion, servicing
+ * this cpu's own messages in the meantime. arg must point to memory
+ * accessible by all targets, i.e. not to the caller's stack. If ret is not
+ * NULL, ret[cpuid] receives the value returned on each target. timeout is
+ * given in timer ticks. Returns the set of targets that completed the call.
+ */
+cpumap_t cpu_call_sync(cpumap_t targets, cpu_call_fn_t fn, void* arg,
+                       long* ret, uint64_t timeout);
 bool cpu_get_msg(struct cpu_msg* msg);
 void cpu_msg_handler();
+void cpu_msg_stats_dump();
+
+/* Times the global barrier at boot, from the last arrival to each release */
+#ifdef BOOT_PROFILE
+void cpu_sync_bench();
+#else
+static inline void cpu_sync_bench() { }
+#endif
+
 void cpu_msg_set_handler(cpuid_t id, cpu_msg_handler_t handler);
 void cpu_idle();
 void cpu_idle_wakeup();
@@ -82,40 +148,45 @@ static inline struct cpuif* cpu_if(cpuid_t cpu_id)
 
 static inline void cpu_sync_init(struct cpu_synctoken* token, size_t n)
 {
-    token->lock = SPINLOCK_INITVAL;
     token->n = n;
     token->count = 0;
+    token->gen = 0;
+    fence_ord_write();
     token->ready = true;
 }
 
-static inline void cpu_sync_barrier(struct cpu_synctoken* token)
+static inline unsigned long cpu_sync_arrive(struct cpu_synctoken* token)
 {
-    // TODO: no fence/barrier needed in this function?
-
-    size_t next_count = 0;
-
     while (!token->ready);
+    fence_ord_read();
+
+    /**
+     * The generation must be sampled before arriving, it can't change until
+     * all cpus, including this one, have arrived.
+     */
+    unsigned long gen = atomic_load_acq(&token->gen);
+    if (atomic_fetch_add(&token->count, 1) == (token->n - 1)) {
+        token->count = 0;
+        atomic_store_rel(&token->gen, gen + 1);
+    }
 
-    spin_lock(&token->lock);
-    token->count++;
-    next_count = ALIGN(token->count, token->n);
-    spin_unlock(&token->lock);
-
-    while (token->count < next_count);
+    return gen;
 }
 
-static inline void cpu_sync_and_clear_msgs(struct cpu_synctoken* token)
+static inline void cpu_sync_barrier(struct cpu_synctoken* token)
 {
-    size_t next_count = 0;
+    unsigned long gen = cpu_sync_arrive(token);
 
-    while (!token->ready);
+    if (atomic_load_acq(&token->gen) == gen) {
+        atomic_wait_neq(&token->gen, gen);
+    }
+}
 
-    spin_lock(&token->lock);
-    token->count++;
-    next_count = ALIGN(token->count, token->n);
-    spin_unlock(&token->lock);
+static inline void cpu_sync_and_clear_msgs(struct cpu_synctoken* token)
+{
+    unsigned long gen = cpu_sync_arrive(token);
 
-    while (token->count < next_count) {
+    while (atomic_load_acq(&token->gen) == gen) {
         if (!cpu()->handling_msgs) cpu_msg_handler();
     }
 
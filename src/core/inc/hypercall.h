@@ -11,7 +11,11 @@
 
 enum {
     HC_INVAL = 0,
-    HC_IPC = 1
+    HC_IPC = 1,
+    HC_LOCK_STATS = 2,
+    HC_MEM_STATS = 3,
+    HC_VM_RECOLOR = 4,
+    HC_CPU_STATS = 5
 };
 
 enum {
@@ -19,6 +19,7 @@ void interrupts_init();
 void interrupts_reserve(irqid_t int_id, irq_handler_t handler);
 
 void interrupts_cpu_sendipi(cpuid_t target_cpu, irqid_t ipi_id);
+void interrupts_cpu_sendipi_mask(cpumap_t cpu_targets, irqid_t ipi_id);
 void interrupts_cpu_enable(irqid_t int_id, bool en);
 
 bool interrupts_check(irqid_t int_id);
@@ -36,6 +37,7 @@ void interrupts_arch_enable(irqid_t int_id, bool en);
 bool interrupts_arch_check(irqid_t int_id);
 void interrupts_arch_clear(irqid_t int_id);
 void interrupts_arch_ipi_send(cpuid_t cpu_target, irqid_t ipi_id);
+void interrupts_arch_ipi_send_mask(cpumap_t cpu_targets, irqid_t ipi_id);
 void interrupts_arch_vm_assign(struct vm *vm, irqid_t id);
 bool interrupts_arch_conflict(bitmap_t* interrupt_bitmap, irqid_t id);
 
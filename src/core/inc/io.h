@@ -38,5 +38,7 @@ void io_init();
 /* iommu api for vms. */
 bool io_vm_init(struct vm *vm, const struct vm_config *config);
 bool io_vm_add_device(struct vm *vm, streamid_t dev_id);
+/* Whether any of the vm devices reach its memory through the iommu */
+bool io_vm_has_devices(struct vm *vm);
 
 #endif /* IO_H_ */
@@ -12,6 +12,7 @@
 #include <spinlock.h>
 #include <cache.h>
 #include <bitmap.h>
+#include <mem_placement.h>
 
 #ifndef __ASSEMBLER__
 
@@ -28,12 +29,38 @@ struct page_pool {
     size_t free;
     size_t last;
     bitmap_t* bitmap;
+#ifdef PAGE_POOL_BUDDY
+    /**
+     * Buddy summary of the bitmap, which remains the authoritative record of
+     * allocated pages. Each node holds one plus the order of the largest
+     * free, naturally aligned block below it, or zero if there is none. The
+     * leaves cover one bitmap granule each.
+     */
+    uint8_t* buddy;
+    size_t buddy_leaves;
+    /* order to which the first page frame of the pool is aligned */
+    size_t buddy_align;
+#endif
+    /**
+     * Per-color summary of the bitmap, only kept on coloring capable builds.
+     * Bit p of row c is set iff all pages of color c in color period p
+     * belong to the pool and are free.
+     */
+    bitmap_t* clr_free;
+    size_t clr_periods;
     spinlock_t lock;
 };
 
 struct mem_region {
     paddr_t base;
     size_t size;
+    /**
+     * Locality attributes, both optional. Regions with the same non zero
+     * domain sit behind the same memory controller. cpus are the clusters
+     * closest to the region.
+     */
+    size_t domain;
+    cpumap_t cpus;
     struct page_pool page_pool;
 };
 
@@ -64,6 +91,9 @@ static inline bool all_clrs(colormap_t clrs)
 void mem_init(paddr_t load_addr);
 void* mem_alloc_page(size_t num_pages, enum AS_SEC sec, bool phys_aligned);
 struct ppages mem_alloc_ppages(colormap_t colors, size_t num_pages, bool aligned);
+struct ppages mem_alloc_ppages_place(colormap_t colors, size_t num_pages,
+                                     bool aligned,
+                                     struct mem_placement *placement);
 vaddr_t mem_alloc_map(struct addr_space* as, enum AS_SEC section, struct ppages *page, 
                         vaddr_t at, size_t num_pages, mem_flags_t flags);
 vaddr_t mem_alloc_map_dev(struct addr_space* as, enum AS_SEC section,
@@ -72,11 +102,59 @@ void mem_unmap(struct addr_space* as, vaddr_t at, size_t num_pages,
                     bool free_ppages);
 bool mem_map_reclr(struct addr_space* as, vaddr_t va, struct ppages* ppages,
                 size_t num_pages, mem_flags_t flags);
+
+/**
+ * Pages of the new colors and the hypervisor windows to copy through, taken
+ * up front so that recoloring several ranges can't fail half-way.
+ */
+struct mem_recolor {
+    struct ppages pages;
+    /* windows onto the old and the new pages of the range being moved */
+    vaddr_t src;
+    vaddr_t dst;
+    size_t window_pages;
+    /* where the windows point while not in use */
+    paddr_t park;
+};
+
+/**
+ * Reserves num_pages pages of the given colors and two windows of window
+ * pages, the largest range to be moved.
+ */
+bool mem_recolor_begin(struct mem_recolor* rclr, colormap_t colors,
+                       size_t num_pages, size_t window);
+/**
+ * Moves the pages mapped at [va, va + num_pages[ to pages taken from the
+ * reservation and frees the old ones. Nothing else may access the range
+ * meanwhile, e.g., the vm owning it is paused.
+ */
+void mem_recolor(struct addr_space* as, enum AS_SEC section, vaddr_t va,
+                 size_t num_pages, struct mem_recolor* rclr, mem_flags_t flags);
+/* Releases the window and whatever is left of the reserved pages */
+void mem_recolor_end(struct mem_recolor* rclr);
+
 vaddr_t mem_map_cpy(struct addr_space *ass, struct addr_space *asd, vaddr_t vas,
                 vaddr_t vad, size_t num_pages);
 bool pp_alloc(struct page_pool *pool, size_t num_pages, bool aligned,
                      struct ppages *ppages);
 
+void pp_sync_index(struct page_pool *pool, size_t index, size_t num_pages);
+bool mem_page_cache_put(struct ppages *ppages);
+void mem_page_cache_dump();
+
+struct vm;
+void mem_color_audit(struct vm* vm);
+
+/* Prints how long the hypervisor took to color itself during boot */
+#ifdef BOOT_PROFILE
+void mem_color_hypervisor_report();
+#else
+static inline void mem_color_hypervisor_report() { }
+#endif
+
+void pp_clr_init(struct page_pool *pool);
+void pp_clr_update(struct page_pool *pool, size_t index, size_t num_pages);
+
 void mem_prot_init();
 size_t mem_cpu_boot_alloc_size();
 
@@ -0,0 +1,38 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __MEM_PLACEMENT_H__
+#define __MEM_PLACEMENT_H__
+
+#include <bao.h>
+
+#ifndef __ASSEMBLER__
+
+/**
+ * Where physical pages are taken from, in terms of the platform memory
+ * regions and their locality attributes (see struct mem_region).
+ */
+enum mem_policy {
+    /* first region that fits, in page pool order */
+    MEM_POLICY_ANY,
+    /* regions local to the placement cpus first, then any other */
+    MEM_POLICY_LOCAL,
+    /* rotate over all regions on each allocation */
+    MEM_POLICY_INTERLEAVE,
+    /* only platform region number region */
+    MEM_POLICY_REGION,
+};
+
+struct mem_placement {
+    enum mem_policy policy;
+    size_t region;
+    /* filled by the hypervisor, not taken from the configuration */
+    cpumap_t cpus;
+    size_t next;
+};
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* __MEM_PLACEMENT_H__ */
@@ -0,0 +1,42 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __MEMGUARD_H__
+#define __MEMGUARD_H__
+
+#include <bao.h>
+
+#ifndef __ASSEMBLER__
+
+/**
+ * Memory bandwidth regulation. Each cpu running a regulated VM counts the
+ * memory events its vcpu causes and, once they reach the VM's budget, stalls
+ * until the next period starts.
+ */
+
+/* What a VM's budget is counted in */
+enum memguard_event {
+    /* refills of the last level cache */
+    MEMGUARD_EV_LLC_REFILL,
+    /* accesses to the memory bus */
+    MEMGUARD_EV_BUS_ACCESS,
+};
+
+struct memguard_config {
+    enum memguard_event event;
+    /* events per period on each cpu, 0 disables regulation */
+    size_t budget;
+    size_t period_us;
+};
+
+struct vm;
+struct vm_config;
+
+void memguard_init(struct vm* vm, const struct vm_config* config);
+void memguard_dump();
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* __MEMGUARD_H__ */
@@ -7,31 +7,70 @@
 #define OBJPOOL_H
 
 #include <bao.h>
-#include <bitmap.h>
-#include <arch/spinlock.h>
+#include <platform_defs.h>
+#include <spinlock.h>
 
+#define OBJPOOL_MAGAZINE_SIZE_DEFAULT (8)
+#ifndef OBJPOOL_MAGAZINE_SIZE
+#define OBJPOOL_MAGAZINE_SIZE OBJPOOL_MAGAZINE_SIZE_DEFAULT
+#endif
+
+/**
+ * Per-cpu stack of free objects, only ever touched by its cpu, which
+ * serves the common alloc/free pairs without taking the pool lock.
+ */
+struct objpool_magazine {
+    size_t count;
+    void* objs[OBJPOOL_MAGAZINE_SIZE];
+    /* objects this cpu allocated and freed, summed over all cpus on dump */
+    size_t allocs;
+    size_t frees;
+};
+
+/**
+ * Free objects are kept in a LIFO list linked through the objects
+ * themselves. Objects that were never handed out are not in the list, they
+ * are taken in order starting at next, so a zeroed pool is ready for use.
+ * taken counts the objects out of the global list, including the ones
+ * cached in the magazines, and high_water its peak, which is what the pool
+ * must be sized for. exhausted counts the allocations that found both the
+ * cpu's magazine and the global list empty.
+ */
 struct objpool {
+    const char* name;
     void* pool;
-    bitmap_t* bitmap;
+    struct objpool_magazine* magazines;
     size_t objsize;
     size_t num;
-    size_t count;
+    size_t magazine_size;
+    void* free_list;
+    size_t next;
+    size_t taken;
+    size_t high_water;
+    size_t exhausted;
     spinlock_t lock;
 };
 
+/**
+ * At most half of the pool can be sitting in the magazines, so that small
+ * pools do not run dry on one cpu while objects idle on the others.
+ */
 #define OBJPOOL_ALLOC(NAME, TYPE, N) \
-    TYPE _##NAME##_array[N];\
-    BITMAP_ALLOC(_##NAME##_array_bitmap, N);\
+    union { TYPE obj; void* next; } _##NAME##_array[N];\
+    struct objpool_magazine _##NAME##_magazines[PLAT_CPU_NUM];\
     struct objpool NAME = {\
+        .name = #NAME,\
         .pool = _##NAME##_array,\
-        .bitmap = _##NAME##_array_bitmap,\
-        .objsize = sizeof(TYPE),\
+        .magazines = _##NAME##_magazines,\
+        .objsize = sizeof(_##NAME##_array[0]),\
         .num = N,\
-        .lock = SPINLOCK_INITVAL,\
+        .magazine_size = min(OBJPOOL_MAGAZINE_SIZE, (N) / (2 * PLAT_CPU_NUM)),\
+        .lock = SPINLOCK_NAMED_INITVAL(#NAME),\
     }
 
 void objpool_init(struct objpool *objpool);
 void* objpool_alloc(struct objpool *objpool);
 void objpool_free(struct objpool *objpool, void* obj);
+void objpool_dump(struct objpool *objpool);
 
 #endif /* OBJPOOL_H */
@@ -6,6 +6,216 @@
 #ifndef __SPINLOCK_H__
 #define __SPINLOCK_H__
 
+#include <bao.h>
+
+#ifdef SPINLOCK_MCS
+
+/**
+ * MCS queued lock. The lock word points to the queue node of the last
+ * waiter, or is zero if the lock is free. Each cpu spins on its own node
+ * so contention does not bounce the lock cache line between waiters.
+ */
+
+typedef volatile unsigned long raw_spinlock_t;
+
+#define RAW_SPINLOCK_INITVAL (0)
+
+void raw_spin_lock(raw_spinlock_t* lock);
+void raw_spin_unlock(raw_spinlock_t* lock);
+
+static inline bool raw_spin_is_locked(raw_spinlock_t* lock)
+{
+    return *lock != 0;
+}
+
+#else
+
 #include <arch/spinlock.h>
 
+#endif /* SPINLOCK_MCS */
+
+#ifndef LOCK_STATS
+
+typedef raw_spinlock_t spinlock_t;
+
+#define SPINLOCK_INITVAL RAW_SPINLOCK_INITVAL
+#define SPINLOCK_NAMED_INITVAL(NAME) SPINLOCK_INITVAL
+#define spin_lock_name(lock, NAME) ((void)0)
+
+static inline void spin_lock(spinlock_t* lock)
+{
+    raw_spin_lock(lock);
+}
+
+static inline void spin_unlock(spinlock_t* lock)
+{
+    raw_spin_unlock(lock);
+}
+
+#else
+
+#include <timer.h>
+
+/**
+ * Lock statistics. Every lock carries its counters, which are only updated
+ * while holding it. Locks register themselves on first acquisition so they
+ * can be listed by lock_stats_dump. Spin times are in timer ticks.
+ */
+
+struct lock_stats {
+    const char* name;
+    bool registered;
+    size_t acquisitions;
+    size_t contended;
+    uint64_t spin_total;
+    uint64_t spin_max;
+};
+
+typedef struct {
+    raw_spinlock_t raw;
+    struct lock_stats stats;
+} spinlock_t;
+
+#define SPINLOCK_INITVAL ((spinlock_t){ .raw = RAW_SPINLOCK_INITVAL })
+#define SPINLOCK_NAMED_INITVAL(NAME) \
+    ((spinlock_t){ .raw = RAW_SPINLOCK_INITVAL, .stats.name = (NAME) })
+#define spin_lock_name(lock, NAME) ((lock)->stats.name = (NAME))
+
+void lock_stats_register(spinlock_t* lock);
+
+static inline void spin_lock(spinlock_t* lock)
+{
+    if (raw_spin_is_locked(&lock->raw)) {
+        uint64_t start = timer_get();
+        raw_spin_lock(&lock->raw);
+        uint64_t spin = timer_get() - start;
+        lock->stats.contended++;
+        lock->stats.spin_total += spin;
+        if (spin > lock->stats.spin_max) {
+            lock->stats.spin_max = spin;
+        }
+    } else {
+        raw_spin_lock(&lock->raw);
+    }
+
+    lock->stats.acquisitions++;
+    if (!lock->stats.registered) {
+        lock_stats_register(lock);
+    }
+}
+
+static inline void spin_unlock(spinlock_t* lock)
+{
+    raw_spin_unlock(&lock->raw);
+}
+
+#endif /* LOCK_STATS */
+
+void lock_stats_dump();
+
+/* Measures the contention on a lock taken by all cpus at boot */
+#ifdef LOCK_BENCH
+void lock_bench();
+#else
+static inline void lock_bench() { }
+#endif
+
+#include <atomic.h>
+#include <fences.h>
+
+/**
+ * Reader-writer spinlock. The lower bits count the readers holding the lock,
+ * the top bit is set by a writer, which then waits for the readers to drain.
+ * New readers are held back while the writer bit is set.
+ */
+
+typedef volatile unsigned long rwlock_t;
+
+#define RWLOCK_INITVAL (0)
+#define RWLOCK_WRITER (1UL << ((sizeof(unsigned long) * 8) - 1))
+
+static inline void rw_read_lock(rwlock_t* lock)
+{
+    unsigned long val;
+
+    do {
+        val = atomic_load_acq(lock);
+    } while ((val & RWLOCK_WRITER) || !atomic_cas(lock, val, val + 1));
+}
+
+static inline void rw_read_unlock(rwlock_t* lock)
+{
+    atomic_fetch_add(lock, -1UL);
+}
+
+static inline void rw_write_lock(rwlock_t* lock)
+{
+    unsigned long val;
+
+    do {
+        val = atomic_load_acq(lock);
+    } while ((val & RWLOCK_WRITER) ||
+             !atomic_cas(lock, val, val | RWLOCK_WRITER));
+
+    while (atomic_load_acq(lock) != RWLOCK_WRITER);
+}
+
+static inline void rw_write_unlock(rwlock_t* lock)
+{
+    atomic_store_rel(lock, 0);
+}
+
+/**
+ * Sequence lock. Writers serialize on the spinlock and make the sequence
+ * odd while updating. Readers never write to the lock: they sample the
+ * sequence, read the protected data and retry if the sequence changed.
+ *
+ *  unsigned long seq;
+ *  do {
+ *      seq = seqlock_read_begin(&sl);
+ *      ... read protected data ...
+ *  } while (seqlock_read_retry(&sl, seq));
+ */
+
+typedef struct {
+    volatile unsigned long seq;
+    spinlock_t lock;
+} seqlock_t;
+
+#define SEQLOCK_INITVAL { .seq = 0, .lock = SPINLOCK_INITVAL }
+
+static inline void seqlock_init(seqlock_t* sl)
+{
+    sl->seq = 0;
+    sl->lock = SPINLOCK_INITVAL;
+}
+
+static inline unsigned long seqlock_read_begin(seqlock_t* sl)
+{
+    unsigned long seq;
+
+    while ((seq = atomic_load_acq(&sl->seq)) & 1);
+
+    return seq;
+}
+
+static inline bool seqlock_read_retry(seqlock_t* sl, unsigned long seq)
+{
+    fence_ord_read();
+    return sl->seq != seq;
+}
+
+static inline void seqlock_write_lock(seqlock_t* sl)
+{
+    spin_lock(&sl->lock);
+    sl->seq++;
+    fence_ord_write();
+}
+
+static inline void seqlock_write_unlock(seqlock_t* sl)
+{
+    atomic_store_rel(&sl->seq, sl->seq + 1);
+    spin_unlock(&sl->lock);
+}
+
 #endif /* __SPINLOCK_H__ */
@@ -0,0 +1,26 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include <bao.h>
+#include <arch/timer.h>
+
+/**
+ * Free running system counter, common to all cpus. Values are in ticks of
+ * timer_get_freq() Hz, which is 0 if the frequency is not known.
+ */
+static inline uint64_t timer_get()
+{
+    return timer_arch_get();
+}
+
+static inline uint64_t timer_get_freq()
+{
+    return timer_arch_freq();
+}
+
+#endif /* __TIMER_H__ */
@@ -11,6 +11,14 @@
 
 #include <mem.h>
 
+/**
+ * Without range operations, invalidations of more than this many entries are
+ * replaced by invalidating the whole address space.
+ */
+#ifndef TLB_INV_RANGE_MAX
+#define TLB_INV_RANGE_MAX (64)
+#endif
+
 static inline void tlb_inv_va(struct addr_space *as, vaddr_t va)
 {
     if (as->type == AS_HYP) {
@@ -31,4 +39,79 @@ static inline void tlb_inv_all(struct addr_space *as)
     }
 }
 
+/**
+ * Invalidates [va, va + size[, mapped by entries of at least stride bytes.
+ * If local, the mappings are only visible to this cpu (i.e. in a private
+ * hypervisor section) and other cpus are left alone.
+ */
+static inline void tlb_inv_range(struct addr_space *as, vaddr_t va,
+                                 size_t size, size_t stride, bool local)
+{
+    bool few = (size / stride) <= TLB_INV_RANGE_MAX;
+
+    if (as->type == AS_HYP && local) {
+        if (few) {
+            for (vaddr_t addr = va; addr < va + size; addr += stride) {
+                tlb_hyp_inv_va_local(addr);
+            }
+        } else {
+            tlb_hyp_inv_all_local();
+        }
+    } else if (as->type == AS_HYP) {
+        if (few || tlb_arch_range(size)) {
+            tlb_hyp_inv_range(va, size, stride);
+        } else {
+            tlb_hyp_inv_all();
+        }
+    } else if (as->type == AS_VM) {
+        if (few || tlb_arch_range(size)) {
+            tlb_vm_inv_range(as->id, va, size, stride);
+        } else {
+            tlb_vm_inv_all(as->id);
+        }
+        // TODO: inval iommu tlbs
+    }
+}
+
+/**
+ * Accumulates the entries changed by one mapping operation so they are
+ * invalidated at once by tlb_batch_flush.
+ */
+struct tlb_batch {
+    struct addr_space *as;
+    bool local;
+    vaddr_t start;
+    vaddr_t end;
+    size_t stride;
+};
+
+static inline void tlb_batch_init(struct tlb_batch *batch,
+                                  struct addr_space *as, bool local)
+{
+    *batch = (struct tlb_batch){.as = as, .local = local};
+}
+
+static inline void tlb_batch_add(struct tlb_batch *batch, vaddr_t va,
+                                 size_t size)
+{
+    if (batch->start == batch->end) {
+        batch->start = va;
+        batch->end = va + size;
+        batch->stride = size;
+    } else {
+        batch->start = min(batch->start, va);
+        batch->end = max(batch->end, va + size);
+        batch->stride = min(batch->stride, size);
+    }
+}
+
+static inline void tlb_batch_flush(struct tlb_batch *batch)
+{
+    if (batch->start != batch->end) {
+        tlb_inv_range(batch->as, batch->start, batch->end - batch->start,
+                      batch->stride, batch->local);
+        batch->start = batch->end = 0;
+    }
+}
+
 #endif
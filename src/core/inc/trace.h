@@ -0,0 +1,30 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <bao.h>
+#include <trace_format.h>
+
+#ifndef TRACE_RING_PAGES
+#define TRACE_RING_PAGES (4)
+#endif
+
+#ifdef TRACE
+
+void trace_init();
+void trace_event(enum trace_event event, unsigned long arg0,
+                 unsigned long arg1);
+
+#else
+
+static inline void trace_init() { }
+static inline void trace_event(enum trace_event event, unsigned long arg0,
+                               unsigned long arg1) { }
+
+#endif /* TRACE */
+
+#endif /* TRACE_H */
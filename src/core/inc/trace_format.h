@@ -0,0 +1,76 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef TRACE_FORMAT_H
+#define TRACE_FORMAT_H
+
+/**
+ * Layout of the hypervisor trace buffer. This header is shared with the host
+ * decoder (scripts/trace_decode.c) so it must only depend on stdint.h.
+ *
+ * The buffer starts with a page aligned header followed by one ring of
+ * record_num records per cpu. Each ring has a single writer, its own cpu,
+ * which publishes record i by:
+ *
+ *     head = i + 1; write records[i % record_num]; commit = i + 1;
+ *
+ * with write ordering between each step. A reader snapshots commit, copies
+ * the last record_num records before it and then re-reads head: any copied
+ * record with index below head - record_num may have been overwritten while
+ * being read and must be discarded. Both counters wrap at 2^32, record_num
+ * is a power of two.
+ */
+
+#include <stdint.h>
+
+#define TRACE_MAGIC (0x45435254) /* "TRCE" */
+#define TRACE_VERSION (1)
+
+#define TRACE_NO_ID (0xffff)
+
+enum trace_event {
+    TRACE_EV_NONE,
+    TRACE_EV_IRQ,         /* arg0: interrupt id */
+    TRACE_EV_CPU_MSG,     /* arg0: handler id, arg1: event */
+    TRACE_EV_HYPERCALL,   /* arg0: hypercall id, arg1: return value */
+    TRACE_EV_ABORT,       /* arg0: exception class, arg1: fault address */
+    TRACE_EV_SYNC_EXCP,   /* arg0: cause, arg1: guest pc */
+    TRACE_EV_VGIC_SPILL,  /* arg0: interrupt id, arg1: list register */
+    TRACE_EV_VGIC_REFILL, /* arg0: interrupt id, arg1: list register */
+    TRACE_EV_MEMGUARD,    /* arg0: period events, arg1: ticks stalled */
+    TRACE_EV_NUM
+};
+
+struct trace_record {
+    uint64_t timestamp;
+    uint16_t event;
+    uint16_t vmid;
+    uint16_t vcpuid;
+    uint16_t cpuid;
+    uint64_t args[2];
+};
+
+struct trace_ring_ctl {
+    volatile uint32_t head;
+    volatile uint32_t commit;
+    /* keep each cpu's counters in their own cache line */
+    uint8_t pad[56];
+};
+
+struct trace_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t cpu_num;
+    uint32_t record_num;
+    uint32_t record_size;
+    /* byte offset of cpu 0's ring from the start of the buffer */
+    uint64_t rings_offset;
+    /* timestamp frequency in Hz, 0 if unknown */
+    uint64_t timer_freq;
+    uint8_t pad[32];
+    struct trace_ring_ctl ring[];
+};
+
+#endif /* TRACE_FORMAT_H */
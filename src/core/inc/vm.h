@@ -24,6 +24,8 @@ struct vm_mem_region {
     colormap_t colors;
     bool place_phys;
     paddr_t phys;
+    /* ignored if place_phys is set */
+    struct mem_placement placement;
 };
 
 struct vm_dev_region {
@@ -116,6 +118,7 @@ void vm_emul_add_reg(struct vm* vm, struct emul_reg* emu);
 emul_handler_t vm_emul_get_mem(struct vm* vm, vaddr_t addr);
 emul_handler_t vm_emul_get_reg(struct vm* vm, vaddr_t addr);
 void vcpu_init(struct vcpu* vcpu, struct vm* vm, vaddr_t entry);
+bool vm_recolor(struct vm* vm, colormap_t colors);
 void vm_msg_broadcast(struct vm* vm, struct cpu_msg* msg);
 cpumap_t vm_translate_to_pcpu_mask(struct vm* vm, cpumap_t mask, size_t len);
 cpumap_t vm_translate_to_vcpu_mask(struct vm* vm, cpumap_t mask, size_t len);
@@ -165,6 +168,7 @@ static inline void vcpu_inject_irq(struct vcpu *vcpu, irqid_t id)
 /* ------------------------------------------------------------*/
 
 void vm_mem_prot_init(struct vm* vm, const struct vm_config* config);
+bool vm_mem_recolor(struct vm* vm, colormap_t colors);
 
 /* ------------------------------------------------------------*/
 
@@ -19,4 +19,7 @@ void vmm_io_init();
 struct vm_install_info vmm_get_vm_install_info(struct vm_allocation *vm_alloc);
 void vmm_vm_install(struct vm_install_info *install_info);
 
+unsigned long vmm_recolor_hypercall(unsigned long vm_id, unsigned long colors,
+                                    unsigned long arg2);
+
 #endif /* __VMM_H__ */
@@ -12,6 +12,7 @@
 #include <printk.h>
 #include <platform.h>
 #include <vmm.h>
+#include <spinlock.h>
 
 void init(cpuid_t cpu_id, paddr_t load_addr)
 {
@@ -28,8 +29,12 @@ void init(cpuid_t cpu_id, paddr_t load_addr)
     
     if (cpu()->id == CPU_MASTER) {
         printk("Bao Hypervisor\n\r");
+        mem_color_hypervisor_report();
     }
 
+    cpu_sync_bench();
+    lock_bench();
+
     interrupts_init();
 
     vmm_init();
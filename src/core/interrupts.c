@@ -20,6 +20,11 @@ inline void interrupts_cpu_sendipi(cpuid_t target_cpu, irqid_t ipi_id)
     interrupts_arch_ipi_send(target_cpu, ipi_id);
 }
 
+inline void interrupts_cpu_sendipi_mask(cpumap_t cpu_targets, irqid_t ipi_id)
+{
+    interrupts_arch_ipi_send_mask(cpu_targets, ipi_id);
+}
+
 inline void interrupts_cpu_enable(irqid_t int_id, bool en)
 {
     interrupts_arch_enable(int_id, en);
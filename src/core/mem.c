@@ -19,6 +19,210 @@ extern uint8_t _image_start, _image_load_end, _image_end, _vm_image_start,
 
 struct list page_pool_list;
 
+#ifdef PAGE_POOL_BUDDY
+
+/* order of the largest block a single leaf, i.e. bitmap granule, holds */
+#define PP_BUDDY_LEAF_ORDER (BITMAP_GRANULE_LEN == 64 ? 6 : 5)
+
+/**
+ * Mask with one bit set at each multiple of 2^order, for order below
+ * PP_BUDDY_LEAF_ORDER.
+ */
+static inline bitmap_granule_t pp_buddy_order_mask(size_t order)
+{
+    return ((bitmap_granule_t)~0) / ((ONE << (1UL << order)) - 1);
+}
+
+static inline bitmap_granule_t pp_buddy_leaf_free(struct page_pool *pool,
+                                                  size_t leaf)
+{
+    size_t first = leaf * BITMAP_GRANULE_LEN;
+    bitmap_granule_t free = ~pool->bitmap[leaf];
+
+    /* bits past the end of the pool are never free */
+    if (pool->size - first < BITMAP_GRANULE_LEN) {
+        free &= BITMAP_GRANULE_MASK(0, pool->size - first);
+    }
+
+    return free;
+}
+
+static uint8_t pp_buddy_leaf_val(struct page_pool *pool, size_t leaf)
+{
+    if (leaf * BITMAP_GRANULE_LEN >= pool->size) return 0;
+
+    bitmap_granule_t free = pp_buddy_leaf_free(pool, leaf);
+    if (free == (bitmap_granule_t)~0) return PP_BUDDY_LEAF_ORDER + 1;
+
+    /**
+     * After folding order times, bit i of free is set iff pages i to
+     * i + 2^order - 1 are all free.
+     */
+    uint8_t val = 0;
+    for (size_t order = 0; order < PP_BUDDY_LEAF_ORDER && free != 0; order++) {
+        if (free & pp_buddy_order_mask(order)) val = order + 1;
+        free &= free >> (1UL << order);
+    }
+
+    return val;
+}
+
+static size_t pp_buddy_leaf_find(struct page_pool *pool, size_t leaf,
+                                 size_t order)
+{
+    bitmap_granule_t free = pp_buddy_leaf_free(pool, leaf);
+
+    for (size_t i = 0; i < order; i++) {
+        free &= free >> (1UL << i);
+    }
+    free &= pp_buddy_order_mask(order);
+
+    return (leaf * BITMAP_GRANULE_LEN) + bit_ctz(free);
+}
+
+static inline uint8_t pp_buddy_merge(uint8_t left, uint8_t right, size_t order)
+{
+    /* both halves entirely free, i.e. holding a block of order - 1 */
+    if (left == order && right == order) return order + 1;
+    return max(left, right);
+}
+
+static void pp_buddy_update(struct page_pool *pool, size_t index,
+                            size_t num_pages)
+{
+    if (pool->buddy == NULL || num_pages == 0) return;
+
+    size_t lo = index / BITMAP_GRANULE_LEN;
+    size_t hi = (index + num_pages - 1) / BITMAP_GRANULE_LEN;
+    for (size_t leaf = lo; leaf <= hi; leaf++) {
+        pool->buddy[pool->buddy_leaves + leaf] = pp_buddy_leaf_val(pool, leaf);
+    }
+
+    lo += pool->buddy_leaves;
+    hi += pool->buddy_leaves;
+    size_t order = PP_BUDDY_LEAF_ORDER;
+    while (lo > 1) {
+        lo /= 2;
+        hi /= 2;
+        order++;
+        for (size_t node = lo; node <= hi; node++) {
+            pool->buddy[node] = pp_buddy_merge(pool->buddy[2 * node],
+                                               pool->buddy[2 * node + 1], order);
+        }
+    }
+}
+
+/**
+ * Finds the lowest free block of the smallest order fitting num_pages.
+ * Returns false if the request can't be expressed as a buddy block and
+ * must be served by the bitmap scan, otherwise bit is set to the first
+ * page of the block or -1 if there is none.
+ */
+static bool pp_buddy_alloc(struct page_pool *pool, size_t num_pages,
+                           bool aligned, ssize_t *bit)
+{
+    if (pool->buddy == NULL) return false;
+
+    size_t order = 0;
+    while ((1UL << order) < num_pages) order++;
+
+    /**
+     * Blocks are aligned relative to the pool's first page, so they're
+     * only physically aligned up to the alignment of the pool base.
+     */
+    if (aligned && (((1UL << order) != num_pages) ||
+                    (order > pool->buddy_align))) {
+        return false;
+    }
+
+    if (pool->buddy[1] <= order) {
+        *bit = -1;
+        /* a smaller unaligned run might still be available */
+        return aligned;
+    }
+
+    size_t node = 1;
+    size_t node_order = PP_BUDDY_LEAF_ORDER;
+    for (size_t n = pool->buddy_leaves; n > 1; n /= 2) node_order++;
+
+    while (node_order > order && node_order > PP_BUDDY_LEAF_ORDER) {
+        node = (pool->buddy[2 * node] > order) ? 2 * node : 2 * node + 1;
+        node_order--;
+    }
+
+    if (node_order > order) {
+        *bit = pp_buddy_leaf_find(pool, node - pool->buddy_leaves, order);
+    } else {
+        size_t level_first =
+            pool->buddy_leaves >> (node_order - PP_BUDDY_LEAF_ORDER);
+        *bit = (node - level_first) << node_order;
+    }
+
+    return true;
+}
+
+static void pp_buddy_init(struct page_pool *pool)
+{
+    size_t leaves = 1;
+    while (leaves < BITMAP_SIZE(pool->size)) leaves *= 2;
+
+    size_t num_pages = NUM_PAGES(2 * leaves * sizeof(uint8_t));
+    uint8_t *buddy = mem_alloc_page(num_pages, SEC_HYP_GLOBAL, false);
+    if (buddy == NULL) {
+        WARNING("Failed to allocate page pool buddy tree");
+        return;
+    }
+    memset(buddy, 0, num_pages * PAGE_SIZE);
+
+    size_t align = 0;
+    size_t pfn = pool->base / PAGE_SIZE;
+    while (align < (sizeof(size_t) * 8 - 1) && !(pfn & (1UL << align))) {
+        align++;
+    }
+
+    spin_lock(&pool->lock);
+    pool->buddy = buddy;
+    pool->buddy_leaves = leaves;
+    pool->buddy_align = align;
+    pp_buddy_update(pool, 0, pool->size);
+    spin_unlock(&pool->lock);
+}
+
+#else
+
+static inline void pp_buddy_update(struct page_pool *pool, size_t index,
+                                   size_t num_pages) { }
+static inline void pp_buddy_init(struct page_pool *pool) { }
+
+static inline bool pp_buddy_alloc(struct page_pool *pool, size_t num_pages,
+                                  bool aligned, ssize_t *bit)
+{
+    return false;
+}
+
+#endif /* PAGE_POOL_BUDDY */
+
+/**
+ * Must be called, holding the pool lock, after changing the bitmap for
+ * pages [index, index + num_pages[, to keep the pool's indices coherent.
+ */
+void pp_sync_index(struct page_pool *pool, size_t index, size_t num_pages)
+{
+    pp_buddy_update(pool, index, num_pages);
+    pp_clr_update(pool, index, num_pages);
+}
+
+static void pp_take(struct page_pool *pool, size_t bit, size_t num_pages,
+                    struct ppages *ppages)
+{
+    ppages->base = pool->base + (bit * PAGE_SIZE);
+    ppages->num_pages = num_pages;
+    bitmap_set_consecutive(pool->bitmap, bit, num_pages);
+    pp_sync_index(pool, bit, num_pages);
+    pool->free -= num_pages;
+    pool->last = bit + num_pages;
+}
+
 bool pp_alloc(struct page_pool *pool, size_t num_pages, bool aligned,
                      struct ppages *ppages)
 {
@@ -31,6 +235,16 @@ bool pp_alloc(struct page_pool *pool, size_t num_pages, bool aligned,
 
     spin_lock(&pool->lock);
 
+    ssize_t buddy_bit = -1;
+    if (pp_buddy_alloc(pool, num_pages, aligned, &buddy_bit)) {
+        if (buddy_bit >= 0) {
+            pp_take(pool, buddy_bit, num_pages, ppages);
+            ok = true;
+        }
+        spin_unlock(&pool->lock);
+        return ok;
+    }
+
     /**
      *  If we need a contigous segment aligned to its size, lets start
      * at an already aligned index.
@@ -69,11 +283,7 @@ bool pp_alloc(struct page_pool *pool, size_t num_pages, bool aligned,
                  * We've found our pages. Fill output argument info, mark
                  * them as allocated, and update page pool bookkeeping.
                  */
-                ppages->base = pool->base + (bit * PAGE_SIZE);
-                ppages->num_pages = num_pages;
-                bitmap_set_consecutive(pool->bitmap, bit, num_pages);
-                pool->free -= num_pages;
-                pool->last = bit + num_pages;
+                pp_take(pool, bit, num_pages, ppages);
                 ok = true;
                 break;
             }
@@ -136,6 +346,7 @@ bool mem_reserve_ppool_ppages(struct page_pool *pool, struct ppages *ppages)
     }
 
     bitmap_set_consecutive(pool->bitmap, pageoff, ppages->num_pages);
+    pp_sync_index(pool, pageoff, ppages->num_pages);
     pool->free -= ppages->num_pages;
 
     return is_in_rgn && was_free;
@@ -205,6 +416,7 @@ static bool pp_root_init(paddr_t load_addr, struct mem_region *root_region)
     root_pool->size =
         root_region->size / PAGE_SIZE; /* TODO: what if not aligned? */
     root_pool->free = root_pool->size;
+    spin_lock_name(&root_pool->lock, "page_pool");
 
     if (!root_pool_set_up_bitmap(load_addr, root_pool)) {
         return false;
@@ -224,6 +436,7 @@ static void pp_init(struct page_pool *pool, paddr_t base, size_t size)
     if (pool == NULL) return;
 
     memset((void*)pool, 0, sizeof(struct page_pool));
+    spin_lock_name(&pool->lock, "page_pool");
     pool->base = ALIGN(base, PAGE_SIZE);
     pool->size = NUM_PAGES(size);
     size_t bitmap_size =
@@ -374,12 +587,26 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region *root_regio
     WARNING("Trying to color hypervisor, but implementation does not suuport it");
 }
 
+#ifdef BOOT_PROFILE
+__attribute__((weak))
+void mem_color_hypervisor_report() { }
+#endif
+
+__attribute__((weak))
+void mem_color_audit(struct vm *vm) { }
+
 __attribute__((weak))
 bool mem_map_reclr(struct addr_space *as, vaddr_t va, struct ppages *ppages,
                     size_t num_pages, mem_flags_t flags) {
     ERROR("Trying to recolor section but there is no coloring implementation");
 }
 
+__attribute__((weak))
+void pp_clr_init(struct page_pool *pool) { }
+
+__attribute__((weak))
+void pp_clr_update(struct page_pool *pool, size_t index, size_t num_pages) { }
+
 __attribute__((weak))
 bool pp_alloc_clr(struct page_pool *pool, size_t num_pages, colormap_t colors,
                          struct ppages *ppages)
@@ -387,21 +614,331 @@ bool pp_alloc_clr(struct page_pool *pool, size_t num_pages, colormap_t colors,
     ERROR("Trying to allocate colored pages but there is no coloring implementation");
 }
 
-struct ppages mem_alloc_ppages(colormap_t colors, size_t num_pages, bool aligned)
+__attribute__((weak))
+bool pp_alloc_clr_aligned(struct page_pool *pool, size_t num_pages,
+                          colormap_t colors, struct ppages *ppages)
+{
+    return false;
+}
+
+static bool pp_alloc_any(struct page_pool *pool, colormap_t colors,
+                         size_t num_pages, bool aligned, struct ppages *pages)
+{
+    if (all_clrs(colors)) {
+        return pp_alloc(pool, num_pages, aligned, pages);
+    } else if (!aligned || num_pages == 1) {
+        return pp_alloc_clr(pool, num_pages, colors, pages);
+    } else {
+        return pp_alloc_clr_aligned(pool, num_pages, colors, pages);
+    }
+}
+
+static struct ppages mem_alloc_ppages_pools(colormap_t colors,
+                                            size_t num_pages, bool aligned)
 {
     struct ppages pages = {.num_pages = 0};
 
     list_foreach(page_pool_list, struct page_pool, pool)
     {
-        bool ok = (!all_clrs(colors) && !aligned)
-                      ? pp_alloc_clr(pool, num_pages, colors, &pages)
-                      : pp_alloc(pool, num_pages, aligned, &pages);
-        if (ok) break;
+        if (pp_alloc_any(pool, colors, num_pages, aligned, &pages)) {
+            return pages;
+        }
+    }
+
+    /**
+     * The colors might not allow a contiguous aligned run of this size at
+     * all, e.g., if they are not consecutive. The colors are then ignored,
+     * which mem_color_audit reports for hypervisor frames.
+     */
+    if (aligned && !all_clrs(colors)) {
+        list_foreach(page_pool_list, struct page_pool, pool)
+        {
+            if (pp_alloc(pool, num_pages, aligned, &pages)) break;
+        }
     }
 
     return pages;
 }
 
+/**
+ * Per-cpu caches of single pages, one stack per color, in front of the page
+ * pools. They are refilled and drained MEM_PAGE_CACHE_BATCH pages at a time
+ * so most one page allocations and frees don't touch the pool locks. Each
+ * cache is only ever accessed by its own cpu. Cached pages are allocated
+ * as far as the pool bitmaps are concerned.
+ */
+#ifndef MEM_PAGE_CACHE_SIZE
+#define MEM_PAGE_CACHE_SIZE (8)
+#endif
+#define MEM_PAGE_CACHE_BATCH (MEM_PAGE_CACHE_SIZE / 2)
+#define MEM_PAGE_CACHE_COLORS (sizeof(colormap_t) * 8)
+
+#if (MEM_PAGE_CACHE_BATCH < 2)
+#error "MEM_PAGE_CACHE_SIZE must be at least 4"
+#endif
+
+struct page_cache {
+    struct {
+        size_t count;
+        paddr_t pages[MEM_PAGE_CACHE_SIZE];
+    } clr[MEM_PAGE_CACHE_COLORS];
+    size_t next_clr;
+    size_t hits;
+    size_t misses;
+    size_t refills;
+    size_t drains;
+};
+
+static struct page_cache page_caches[PLAT_CPU_NUM];
+
+/**
+ * The caches live in the hypervisor image, so they are only enabled once the
+ * image is no longer copied around by hypervisor coloring.
+ */
+static volatile bool page_caches_enabled;
+
+static inline size_t mem_page_clr(paddr_t addr)
+{
+    return (addr / PAGE_SIZE / COLOR_SIZE) % COLOR_NUM;
+}
+
+/* The page following addr in a run allocated with a single color */
+static inline paddr_t mem_next_clr_page(paddr_t addr)
+{
+    size_t pn = (addr / PAGE_SIZE) + 1;
+    if (COLOR_NUM > 1 && (pn % COLOR_SIZE) == 0) {
+        pn += (COLOR_NUM - 1) * COLOR_SIZE;
+    }
+    return pn * PAGE_SIZE;
+}
+
+static void mem_page_cache_drain(paddr_t *pages, size_t num)
+{
+    list_foreach(page_pool_list, struct page_pool, pool)
+    {
+        spin_lock(&pool->lock);
+        for (size_t i = 0; i < num; i++) {
+            if (in_range(pages[i], pool->base, pool->size * PAGE_SIZE)) {
+                size_t index = (pages[i] - pool->base) / PAGE_SIZE;
+                bitmap_clear(pool->bitmap, index);
+                pp_sync_index(pool, index, 1);
+                pool->free++;
+            }
+        }
+        spin_unlock(&pool->lock);
+    }
+}
+
+static bool mem_page_cache_refill(struct page_cache *cache, colormap_t mask)
+{
+    size_t clr = cache->next_clr;
+    for (size_t i = 0; i < COLOR_NUM; i++, clr = (clr + 1) % COLOR_NUM) {
+        if (!(mask & (1UL << clr))) continue;
+
+        struct ppages batch = mem_alloc_ppages_pools(
+            1UL << clr, MEM_PAGE_CACHE_BATCH, false);
+        if (batch.num_pages != MEM_PAGE_CACHE_BATCH) continue;
+
+        paddr_t addr = batch.base;
+        for (size_t j = 0; j < MEM_PAGE_CACHE_BATCH; j++) {
+            cache->clr[clr].pages[cache->clr[clr].count++] = addr;
+            addr = mem_next_clr_page(addr);
+        }
+        /* spread consecutive refills over the requested colors */
+        cache->next_clr = (clr + 1) % COLOR_NUM;
+        cache->refills++;
+        return true;
+    }
+
+    return false;
+}
+
+static bool mem_page_cache_get(colormap_t colors, struct ppages *ppages)
+{
+    if (!page_caches_enabled) return false;
+
+    struct page_cache *cache = &page_caches[cpu()->id];
+    colormap_t mask = all_clrs(colors) ? BIT_MASK(0, COLOR_NUM) : colors;
+
+    for (size_t pass = 0; pass < 2; pass++) {
+        for (size_t clr = 0; clr < COLOR_NUM; clr++) {
+            if ((mask & (1UL << clr)) && cache->clr[clr].count > 0) {
+                ppages->base =
+                    cache->clr[clr].pages[--cache->clr[clr].count];
+                ppages->num_pages = 1;
+                ppages->colors = colors;
+                if (pass == 0) cache->hits++;
+                return true;
+            }
+        }
+
+        cache->misses++;
+        if (!mem_page_cache_refill(cache, mask)) break;
+    }
+
+    return false;
+}
+
+/**
+ * Pages that belong to no pool, e.g. in place VM image pages, must not end
+ * up in the caches or they would be handed out as free pool memory. Pool
+ * bounds do not change after mem_init, so no lock is taken.
+ */
+static bool mem_page_in_pools(paddr_t addr)
+{
+    list_foreach(page_pool_list, struct page_pool, pool)
+    {
+        if (in_range(addr, pool->base, pool->size * PAGE_SIZE)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool mem_page_cache_put(struct ppages *ppages)
+{
+    if (!page_caches_enabled || ppages->num_pages != 1 ||
+        !mem_page_in_pools(ppages->base)) {
+        return false;
+    }
+
+    struct page_cache *cache = &page_caches[cpu()->id];
+    size_t clr = mem_page_clr(ppages->base);
+
+    if (cache->clr[clr].count == MEM_PAGE_CACHE_SIZE) {
+        cache->clr[clr].count -= MEM_PAGE_CACHE_BATCH;
+        mem_page_cache_drain(&cache->clr[clr].pages[cache->clr[clr].count],
+                             MEM_PAGE_CACHE_BATCH);
+        cache->drains++;
+    }
+    cache->clr[clr].pages[cache->clr[clr].count++] = ppages->base;
+
+    return true;
+}
+
+void mem_page_cache_dump()
+{
+    for (size_t i = 0; i < PLAT_CPU_NUM; i++) {
+        struct page_cache *cache = &page_caches[i];
+        size_t total = cache->hits + cache->misses;
+        INFO("cpu %lu page cache: hits %lu/%lu (%lu%%) refills %lu drains %lu",
+             (unsigned long)i, (unsigned long)cache->hits, (unsigned long)total,
+             (unsigned long)(total ? (cache->hits * 100) / total : 0),
+             (unsigned long)cache->refills, (unsigned long)cache->drains);
+    }
+}
+
+struct ppages mem_alloc_ppages(colormap_t colors, size_t num_pages, bool aligned)
+{
+    struct ppages pages = {.num_pages = 0};
+
+    if (num_pages == 1 && mem_page_cache_get(colors, &pages)) {
+        return pages;
+    }
+
+    return mem_alloc_ppages_pools(colors, num_pages, aligned);
+}
+
+static bool mem_alloc_ppages_rgn(struct mem_region *reg, colormap_t colors,
+                                 size_t num_pages, bool aligned,
+                                 struct ppages *ppages)
+{
+    struct page_pool *pool = &reg->page_pool;
+
+    /* pools are only set up during mem_init */
+    if (pool->bitmap == NULL) return false;
+
+    return pp_alloc_any(pool, colors, num_pages, aligned, ppages);
+}
+
+static bool mem_rgn_is_local(struct mem_region *reg, cpumap_t cpus)
+{
+    if (reg->cpus & cpus) return true;
+    if (reg->domain == 0) return false;
+
+    for (size_t i = 0; i < platform.region_num; i++) {
+        struct mem_region *other = &platform.regions[i];
+        if (other->domain == reg->domain && (other->cpus & cpus)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static struct ppages mem_alloc_ppages_local(colormap_t colors,
+                                            size_t num_pages, bool aligned,
+                                            cpumap_t cpus)
+{
+    struct ppages pages = {.num_pages = 0};
+
+    /* first pass over the local regions, second over the remaining ones */
+    for (size_t pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < platform.region_num; i++) {
+            struct mem_region *reg = &platform.regions[i];
+            if (mem_rgn_is_local(reg, cpus) == (pass != 0)) continue;
+            if (mem_alloc_ppages_rgn(reg, colors, num_pages, aligned,
+                                     &pages)) {
+                return pages;
+            }
+        }
+    }
+
+    return pages;
+}
+
+static struct ppages mem_alloc_ppages_interleave(colormap_t colors,
+                                                 size_t num_pages,
+                                                 bool aligned,
+                                                 struct mem_placement *plc)
+{
+    struct ppages pages = {.num_pages = 0};
+
+    for (size_t i = 0; i < platform.region_num; i++) {
+        size_t rgn = (plc->next + i) % platform.region_num;
+        if (mem_alloc_ppages_rgn(&platform.regions[rgn], colors, num_pages,
+                                 aligned, &pages)) {
+            plc->next = rgn + 1;
+            break;
+        }
+    }
+
+    return pages;
+}
+
+/**
+ * Placement aware allocation. Only MEM_POLICY_ANY goes through the per-cpu
+ * page caches as these don't keep track of where their pages came from.
+ */
+struct ppages mem_alloc_ppages_place(colormap_t colors, size_t num_pages,
+                                     bool aligned,
+                                     struct mem_placement *placement)
+{
+    struct ppages pages = {.num_pages = 0};
+
+    if (placement == NULL) {
+        return mem_alloc_ppages(colors, num_pages, aligned);
+    }
+
+    switch (placement->policy) {
+        case MEM_POLICY_LOCAL:
+            return mem_alloc_ppages_local(colors, num_pages, aligned,
+                                          placement->cpus);
+        case MEM_POLICY_INTERLEAVE:
+            return mem_alloc_ppages_interleave(colors, num_pages, aligned,
+                                               placement);
+        case MEM_POLICY_REGION:
+            if (placement->region < platform.region_num) {
+                mem_alloc_ppages_rgn(&platform.regions[placement->region],
+                                     colors, num_pages, aligned, &pages);
+            }
+            return pages;
+        default:
+            return mem_alloc_ppages(colors, num_pages, aligned);
+    }
+}
+
 void mem_init(paddr_t load_addr)
 {      
     mem_prot_init();
@@ -436,6 +973,19 @@ void mem_init(paddr_t load_addr)
         if (!mem_create_ppools(root_mem_region)) {
             ERROR("couldn't create additional page pools");
         }
+
+
+        /**
+         * Only now, with the hypervisor in its final location, are the
+         * pool indices built. Until then all pools use the bitmap scan.
+         */
+        list_foreach(page_pool_list, struct page_pool, pool)
+        {
+            pp_buddy_init(pool);
+            pp_clr_init(pool);
+        }
+
+        page_caches_enabled = true;
     }
 
     /* Wait for master core to initialize memory management */
@@ -0,0 +1,155 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <memguard.h>
+#include <arch/memguard.h>
+
+#include <cpu.h>
+#include <vm.h>
+#include <config.h>
+#include <interrupts.h>
+#include <timer.h>
+#include <trace.h>
+
+struct memguard {
+    bool enabled;
+    size_t budget;
+    /* in timer ticks */
+    uint64_t period;
+    uint64_t next;
+    /* ticks stalled in the current period */
+    uint64_t stalled;
+    struct {
+        size_t periods;
+        size_t throttled;
+        uint64_t stalled;
+        uint64_t events;
+        size_t last;
+    } stats;
+};
+
+static struct memguard memguard_cpus[PLAT_CPU_NUM];
+
+/**
+ * Closes the current period, accounting its events, and starts the next
+ * with a full budget. Periods missed while the hypervisor was busy are
+ * skipped, not replenished.
+ */
+static void memguard_replenish(struct memguard* mg)
+{
+    size_t events = memguard_arch_count(mg->budget);
+    uint64_t now = timer_get();
+
+    mg->stats.periods++;
+    mg->stats.events += events;
+    mg->stats.stalled += mg->stalled;
+    mg->stats.last = events;
+    if (mg->stalled != 0) {
+        mg->stats.throttled++;
+    }
+    trace_event(TRACE_EV_MEMGUARD, events, mg->stalled);
+    mg->stalled = 0;
+
+    mg->next += mg->period;
+    if (mg->next <= now) {
+        mg->next = now + mg->period;
+    }
+
+    memguard_arch_timer_set(mg->next);
+    memguard_arch_start(mg->budget);
+}
+
+static void memguard_tick_handler(irqid_t int_id)
+{
+    struct memguard* mg = &memguard_cpus[cpu()->id];
+
+    if (mg->enabled && timer_get() >= mg->next) {
+        memguard_replenish(mg);
+    }
+}
+
+static void memguard_overflow_handler(irqid_t int_id)
+{
+    struct memguard* mg = &memguard_cpus[cpu()->id];
+
+    if (!memguard_arch_overflow() || !mg->enabled) {
+        return;
+    }
+
+    /**
+     * The budget is spent, so the vcpu is not resumed before the next
+     * period. Until this handler returns, the overflow interrupt keeps the
+     * period tick and message IPIs, which share its priority, from being
+     * signalled, so the cpu can't sleep waiting for them. Poll the timer and
+     * the message ring instead, serving messages as other cpus might be
+     * waiting on this one.
+     */
+    uint64_t start = timer_get();
+    uint64_t now = start;
+    while (now < mg->next) {
+        cpu_msg_handler();
+        now = timer_get();
+    }
+    mg->stalled += now - start;
+
+    memguard_replenish(mg);
+}
+
+void memguard_init(struct vm* vm, const struct vm_config* config)
+{
+    struct memguard* mg = &memguard_cpus[cpu()->id];
+    uint64_t freq = timer_get_freq();
+
+    *mg = (struct memguard){.enabled = false};
+
+    if (config->memguard.budget == 0) {
+        return;
+    }
+
+    if (freq == 0 || config->memguard.period_us == 0 ||
+        config->memguard.budget > MEMGUARD_ARCH_BUDGET_MAX ||
+        vm_has_interrupt(vm, MEMGUARD_ARCH_PMU_IRQ) ||
+        vm_has_interrupt(vm, MEMGUARD_ARCH_TIMER_IRQ) ||
+        !memguard_arch_init(config->memguard.event)) {
+        if (cpu()->id == vm->master) {
+            WARNING("vm %d memory bandwidth regulation not available", vm->id);
+        }
+        return;
+    }
+
+    mg->budget = config->memguard.budget;
+    mg->period = max((freq * config->memguard.period_us) / 1000000, 1);
+    mg->next = timer_get() + mg->period;
+    mg->enabled = true;
+
+    interrupts_reserve(MEMGUARD_ARCH_PMU_IRQ, memguard_overflow_handler);
+    interrupts_reserve(MEMGUARD_ARCH_TIMER_IRQ, memguard_tick_handler);
+
+    memguard_arch_timer_set(mg->next);
+    memguard_arch_start(mg->budget);
+
+    interrupts_cpu_enable(MEMGUARD_ARCH_PMU_IRQ, true);
+    interrupts_cpu_enable(MEMGUARD_ARCH_TIMER_IRQ, true);
+}
+
+void memguard_dump()
+{
+    for (size_t i = 0; i < PLAT_CPU_NUM; i++) {
+        struct memguard* mg = &memguard_cpus[i];
+        if (!mg->enabled) {
+            continue;
+        }
+        INFO("cpu %lu memguard: budget %lu periods %lu throttled %lu "
+             "(%lu%%) events %lu last %lu stalled %lu ticks",
+             (unsigned long)i, (unsigned long)mg->budget,
+             (unsigned long)mg->stats.periods,
+             (unsigned long)mg->stats.throttled,
+             (unsigned long)(mg->stats.periods ?
+                                 (mg->stats.throttled * 100) / mg->stats.periods :
+                                 0),
+             (unsigned long)mg->stats.events, (unsigned long)mg->stats.last,
+             (unsigned long)mg->stats.stalled);
+    }
+}
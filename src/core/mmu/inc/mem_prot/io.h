@@ -20,5 +20,6 @@ struct io_prot {
 bool iommu_arch_init();
 bool iommu_arch_vm_init(struct vm *vm, const struct vm_config *config);
 bool iommu_arch_vm_add_device(struct vm *vm, streamid_t id);
+bool iommu_arch_vm_has_devices(struct vm *vm);
 
 #endif /* MEM_PROT_IO_H */
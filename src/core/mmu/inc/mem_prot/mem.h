@@ -10,13 +10,50 @@
 #include <arch/mem.h>
 #include <page_table.h>
 #include <spinlock.h>
+#include <mem_placement.h>
 
 #define HYP_ASID  0
+
+#ifndef AS_PT_CACHE_SIZE
+#define AS_PT_CACHE_SIZE (4)
+#endif
+
+#ifndef VAS_EXTENTS_NUM
+#define VAS_EXTENTS_NUM (32)
+#endif
+
+/**
+ * Free virtual pages of a section as sorted, non adjacent ranges of page
+ * numbers. Built from the page tables on first use, after which the page
+ * tables only hold actual translations. If the ranges found then do not fit,
+ * overflow is set and the section keeps being allocated from the page tables.
+ */
+struct vas_extents {
+    bool seeded;
+    bool overflow;
+    size_t num;
+    struct {
+        size_t first;
+        size_t last;
+    } ext[VAS_EXTENTS_NUM];
+};
+
 struct addr_space {
     struct page_table pt;
     enum AS_TYPE type;
     colormap_t colors;
+    struct mem_placement placement;
     asid_t id;
+    /**
+     * Single page tables reclaimed by mem_unmap, reused by the next table
+     * allocations of this address space. All their entries are zero.
+     */
+    struct {
+        size_t num;
+        paddr_t pages[AS_PT_CACHE_SIZE];
+    } pt_cache;
+    /* free space of the address space's only non shared section */
+    struct vas_extents vas;
     spinlock_t lock;
 };
 enum AS_SEC;
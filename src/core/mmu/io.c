@@ -40,3 +40,8 @@ bool io_vm_add_device(struct vm *vm, streamid_t dev_id)
 
     return res;
 }
+
+bool io_vm_has_devices(struct vm *vm)
+{
+    return iommu_arch_vm_has_devices(vm);
+}
@@ -15,6 +15,7 @@
 #include <fences.h>
 #include <tlb.h>
 #include <config.h>
+#include <timer.h>
 
 extern uint8_t _image_start, _image_load_end, _image_end, _dmem_phys_beg,
      _dmem_beg, _cpu_private_beg, _cpu_private_end, _vm_beg, _vm_end,
@@ -32,19 +33,23 @@ struct section {
     vaddr_t end;
     bool shared;
     spinlock_t lock;
+    /* free space of shared sections, the others keep it in addr_space */
+    struct vas_extents vas;
 };
 
 struct section hyp_secs[] = {
     [SEC_HYP_GLOBAL] = {(vaddr_t)&_dmem_beg, (vaddr_t)&_cpu_private_beg - 1, true,
-                        SPINLOCK_INITVAL},
-    [SEC_HYP_IMAGE] = {(vaddr_t)&_image_start, (vaddr_t)&_image_end - 1, true, SPINLOCK_INITVAL},
+                        SPINLOCK_NAMED_INITVAL("sec_hyp_global")},
+    [SEC_HYP_IMAGE] = {(vaddr_t)&_image_start, (vaddr_t)&_image_end - 1, true,
+                       SPINLOCK_NAMED_INITVAL("sec_hyp_image")},
     [SEC_HYP_PRIVATE] = {(vaddr_t)&_cpu_private_beg, (vaddr_t)&_cpu_private_end - 1, false,
-                         SPINLOCK_INITVAL},
-    [SEC_HYP_VM] = {(vaddr_t)&_vm_beg, (vaddr_t)&_vm_end - 1, true, SPINLOCK_INITVAL},
+                         SPINLOCK_NAMED_INITVAL("sec_hyp_private")},
+    [SEC_HYP_VM] = {(vaddr_t)&_vm_beg, (vaddr_t)&_vm_end - 1, true,
+                    SPINLOCK_NAMED_INITVAL("sec_hyp_vm")},
 };
 
 struct section vm_secs[] = {
-    [SEC_VM_ANY] = {0x0, MAX_VA, false, SPINLOCK_INITVAL}};
+    [SEC_VM_ANY] = {0x0, MAX_VA, false, SPINLOCK_NAMED_INITVAL("sec_vm_any")}};
 
 struct {
     struct section *sec;
@@ -63,32 +68,234 @@ size_t mem_cpu_boot_alloc_size() {
     return size;
 }
 
+static inline size_t pp_clr_offset(paddr_t base)
+{
+    return (base / PAGE_SIZE) % (COLOR_NUM * COLOR_SIZE);
+}
+
 static inline size_t pp_next_clr(paddr_t base, size_t from, colormap_t colors)
 {
-    size_t clr_offset = (base / PAGE_SIZE) % (COLOR_NUM * COLOR_SIZE);
+    size_t clr_offset = pp_clr_offset(base);
     size_t index = from;
 
-    while (!((colors >> ((index + clr_offset) / COLOR_SIZE % COLOR_NUM)) & 1))
-        index++;
+    while (!((colors >> ((index + clr_offset) / COLOR_SIZE % COLOR_NUM)) & 1)) {
+        /* the rest of this color block has the same color, skip it */
+        index += COLOR_SIZE - ((index + clr_offset) % COLOR_SIZE);
+    }
 
     return index;
 }
 
+static inline bitmap_t *pp_clr_row(struct page_pool *pool, size_t color)
+{
+    return pool->clr_free + (color * BITMAP_SIZE(pool->clr_periods));
+}
+
+/**
+ * Recomputes the summary bit of color block blk, i.e. the pages of color
+ * blk % COLOR_NUM in period blk / COLOR_NUM.
+ */
+static void pp_clr_block_update(struct page_pool *pool, size_t blk)
+{
+    size_t clr_offset = pp_clr_offset(pool->base);
+    bitmap_t *row = pp_clr_row(pool, blk % COLOR_NUM);
+    size_t period = blk / COLOR_NUM;
+    bool free = false;
+
+    if ((blk * COLOR_SIZE) >= clr_offset) {
+        size_t start = (blk * COLOR_SIZE) - clr_offset;
+        free = ((start + COLOR_SIZE) <= pool->size) &&
+               !bitmap_get(pool->bitmap, start) &&
+               (bitmap_count_consecutive(pool->bitmap, pool->size, start,
+                                         COLOR_SIZE) >= COLOR_SIZE);
+    }
+
+    if (free) {
+        bitmap_set(row, period);
+    } else {
+        bitmap_clear(row, period);
+    }
+}
+
+void pp_clr_update(struct page_pool *pool, size_t index, size_t num_pages)
+{
+    if (pool->clr_free == NULL || num_pages == 0) return;
+
+    size_t clr_offset = pp_clr_offset(pool->base);
+    size_t first = (index + clr_offset) / COLOR_SIZE;
+    size_t last = (index + num_pages - 1 + clr_offset) / COLOR_SIZE;
+
+    for (size_t blk = first; blk <= last; blk++) {
+        pp_clr_block_update(pool, blk);
+    }
+}
+
+void pp_clr_init(struct page_pool *pool)
+{
+    if (COLOR_NUM <= 1) return;
+
+    size_t periods = (pp_clr_offset(pool->base) + pool->size +
+                      (COLOR_NUM * COLOR_SIZE) - 1) /
+                     (COLOR_NUM * COLOR_SIZE);
+    size_t size =
+        COLOR_NUM * BITMAP_SIZE(periods) * sizeof(bitmap_granule_t);
+    bitmap_t *clr_free =
+        mem_alloc_page(NUM_PAGES(size), SEC_HYP_GLOBAL, false);
+    if (clr_free == NULL) {
+        WARNING("Failed to allocate page pool color index");
+        return;
+    }
+    memset((void*)clr_free, 0, NUM_PAGES(size) * PAGE_SIZE);
+
+    spin_lock(&pool->lock);
+    pool->clr_periods = periods;
+    pool->clr_free = clr_free;
+    pp_clr_update(pool, 0, pool->size);
+    spin_unlock(&pool->lock);
+}
+
+/**
+ * Looks for num_periods consecutive periods in which all pages of the given
+ * colors are free, starting at period from. Whole summary granules are
+ * tested at once.
+ */
+static ssize_t pp_clr_find(struct page_pool *pool, colormap_t colors,
+                           size_t num_periods, size_t from, size_t to)
+{
+    bitmap_granule_t word = 0;
+    size_t run = 0;
+    size_t start = 0;
+
+    for (size_t p = from; p < to; p++) {
+        size_t bit = p % BITMAP_GRANULE_LEN;
+        if (bit == 0 || p == from) {
+            word = (bitmap_granule_t)~0;
+            for (size_t c = 0; c < COLOR_NUM && word != 0; c++) {
+                if (colors & (1UL << c)) {
+                    word &= pp_clr_row(pool, c)[p / BITMAP_GRANULE_LEN];
+                }
+            }
+            if (bit == 0 && ((p + BITMAP_GRANULE_LEN) <= to)) {
+                if (word == 0) {
+                    run = 0;
+                    p += BITMAP_GRANULE_LEN - 1;
+                    continue;
+                } else if (word == (bitmap_granule_t)~0 &&
+                           (run + BITMAP_GRANULE_LEN) < num_periods) {
+                    if (run == 0) start = p;
+                    run += BITMAP_GRANULE_LEN;
+                    p += BITMAP_GRANULE_LEN - 1;
+                    continue;
+                }
+            }
+        }
+
+        if (word & (ONE << bit)) {
+            if (run++ == 0) start = p;
+            if (run == num_periods) return start;
+        } else {
+            run = 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Fast path of pp_alloc_clr. Allocations are served from whole color periods
+ * so that, for each color, its pages are known to be free from the summary
+ * alone. Must be called holding the pool lock.
+ */
+static bool pp_alloc_clr_idx(struct page_pool *pool, size_t n,
+                             colormap_t colors, struct ppages *ppages)
+{
+    if (pool->clr_free == NULL) return false;
+
+    size_t clr_offset = pp_clr_offset(pool->base);
+    size_t ncolors = bit_count(colors & BIT_MASK(0, COLOR_NUM));
+    if (ncolors == 0) return false;
+
+    size_t per_period = ncolors * COLOR_SIZE;
+    size_t num_periods = (n + per_period - 1) / per_period;
+    size_t hint = (pool->last + clr_offset) / (COLOR_NUM * COLOR_SIZE);
+    hint = min(hint, pool->clr_periods);
+
+    ssize_t period = pp_clr_find(pool, colors, num_periods, hint,
+                                 pool->clr_periods);
+    if (period < 0) {
+        period = pp_clr_find(pool, colors, num_periods, 0,
+                             min(hint + num_periods, pool->clr_periods));
+    }
+    if (period < 0) return false;
+
+    size_t left = n;
+    size_t first = 0;
+    size_t last = 0;
+    for (size_t p = period; left > 0; p++) {
+        for (size_t c = 0; c < COLOR_NUM && left > 0; c++) {
+            if (colors & (1UL << c)) {
+                size_t start = ((p * COLOR_NUM + c) * COLOR_SIZE) - clr_offset;
+                size_t count = min(left, COLOR_SIZE);
+                if (left == n) first = start;
+                bitmap_set_consecutive(pool->bitmap, start, count);
+                last = start + count;
+                left -= count;
+            }
+        }
+    }
+    pp_sync_index(pool, first, last - first);
+
+    ppages->base = pool->base + (first * PAGE_SIZE);
+    ppages->num_pages = n;
+    pool->free -= n;
+    pool->last = last;
+
+    return true;
+}
+
 static void mem_free_ppages(struct ppages *ppages)
 {
+    if (mem_page_cache_put(ppages)) {
+        return;
+    }
+
+    paddr_t top = ppages->base + (ppages->num_pages * PAGE_SIZE);
+
     list_foreach(page_pool_list, struct page_pool, pool)
     {
+        paddr_t pool_top = pool->base + (pool->size * PAGE_SIZE);
+
         spin_lock(&pool->lock);
-        if (in_range(ppages->base, pool->base, pool->size * PAGE_SIZE)) {
-            size_t index = (ppages->base - pool->base) / PAGE_SIZE;
-            if (!all_clrs(ppages->colors)) {
-                for (size_t i = 0; i < ppages->num_pages; i++) {
+        if (!all_clrs(ppages->colors)) {
+            /* colored pages are always allocated from a single pool */
+            if (in_range(ppages->base, pool->base, pool->size * PAGE_SIZE)) {
+                size_t index = (ppages->base - pool->base) / PAGE_SIZE;
+                size_t first = index;
+                size_t clr_offset = pp_clr_offset(pool->base);
+                size_t left = ppages->num_pages;
+                while (left > 0) {
                     index = pp_next_clr(pool->base, index, ppages->colors);
-                    bitmap_clear(pool->bitmap, index++);
+                    size_t count = min(left, COLOR_SIZE -
+                                       ((index + clr_offset) % COLOR_SIZE));
+                    bitmap_clear_consecutive(pool->bitmap, index, count);
+                    index += count;
+                    left -= count;
                 }
-            } else {
-                bitmap_clear_consecutive(pool->bitmap, index, ppages->num_pages);
+                pp_sync_index(pool, first, index - first);
+                pool->free += ppages->num_pages;
             }
+        } else if (ppages->base < pool_top && top > pool->base) {
+            /**
+             * Physically contiguous runs, e.g., merged while unmapping, may
+             * cross into the next pool, so only the part in this one is freed
+             * here.
+             */
+            paddr_t start = max(ppages->base, pool->base);
+            size_t index = (start - pool->base) / PAGE_SIZE;
+            size_t num_pages = (min(top, pool_top) - start) / PAGE_SIZE;
+            bitmap_clear_consecutive(pool->bitmap, index, num_pages);
+            pp_sync_index(pool, index, num_pages);
+            pool->free += num_pages;
         }
         spin_unlock(&pool->lock);
     }
@@ -107,6 +314,11 @@ bool pp_alloc_clr(struct page_pool *pool, size_t n, colormap_t colors,
 
     spin_lock(&pool->lock);
 
+    if (pp_alloc_clr_idx(pool, n, colors, ppages)) {
+        spin_unlock(&pool->lock);
+        return true;
+    }
+
     /**
      * Lets start the search at the first available color after the last
      * known free position to the top of the pool.
@@ -151,10 +363,12 @@ bool pp_alloc_clr(struct page_pool *pool, size_t n, colormap_t colors,
              */
             ppages->num_pages = n;
             ppages->base = pool->base + (first_index * PAGE_SIZE);
+            size_t update_first = first_index;
             for (size_t i = 0; i < n; i++) {
                 first_index = pp_next_clr(pool->base, first_index, colors);
                 bitmap_set(pool->bitmap, first_index++);
             }
+            pp_sync_index(pool, update_first, first_index - update_first);
             pool->free -= n;
             pool->last = first_index;
             ok = true;
@@ -174,6 +388,46 @@ bool pp_alloc_clr(struct page_pool *pool, size_t n, colormap_t colors,
     return ok;
 }
 
+/**
+ * Contiguous allocation, aligned to its size, of pages that are all of the
+ * given colors. It only succeeds if enough consecutive colors are set.
+ */
+bool pp_alloc_clr_aligned(struct page_pool *pool, size_t n, colormap_t colors,
+                          struct ppages *ppages)
+{
+    size_t clr_offset = pp_clr_offset(pool->base);
+    size_t start = (n - ((pool->base / PAGE_SIZE) % n)) % n;
+    bool ok = false;
+
+    ppages->colors = 0;
+    ppages->num_pages = 0;
+
+    spin_lock(&pool->lock);
+
+    for (size_t index = start; (index + n) <= pool->size && pool->free >= n;
+         index += n) {
+        size_t i = 0;
+        while ((i < n) && !bitmap_get(pool->bitmap, index + i) &&
+               ((colors >> (((index + i + clr_offset) / COLOR_SIZE) % COLOR_NUM)) &
+                1)) {
+            i++;
+        }
+
+        if (i == n) {
+            ppages->base = pool->base + (index * PAGE_SIZE);
+            ppages->num_pages = n;
+            bitmap_set_consecutive(pool->bitmap, index, n);
+            pp_sync_index(pool, index, n);
+            pool->free -= n;
+            ok = true;
+            break;
+        }
+    }
+
+    spin_unlock(&pool->lock);
+
+    return ok;
+}
 
 static struct section *mem_find_sec(struct addr_space *as, vaddr_t va)
 {
@@ -201,18 +455,89 @@ static inline pte_t *mem_alloc_pt(struct addr_space *as, pte_t *parent, size_t l
 {
     /* Must have lock on as and va section to call */
     size_t ptsize = NUM_PAGES(pt_size(&as->pt, lvl + 1));
-    struct ppages ppage = mem_alloc_ppages(as->colors, ptsize, ptsize > 1 ? true : false);
-    if (ppage.num_pages == 0) return NULL;
+    struct ppages ppage;
+    bool zeroed = false;
+    if (ptsize == 1 && as->pt_cache.num > 0) {
+        ppage = mem_ppages_get(as->pt_cache.pages[--as->pt_cache.num], 1);
+        zeroed = true;
+    } else {
+        /* tables are hypervisor frames, even those of a vm address space */
+        ppage = mem_alloc_ppages(cpu()->as.colors, ptsize,
+                                 ptsize > 1 ? true : false);
+        if (ppage.num_pages == 0) return NULL;
+    }
     pte_t pte_dflt_val = PTE_INVALID | (*parent & PTE_RSW_MSK);
     pte_set(parent, ppage.base, PTE_TABLE, PTE_HYP_FLAGS);
     fence_sync_write();
     pte_t *temp_pt = pt_get(&as->pt, lvl + 1, addr);
-    for (size_t i = 0; i < pt_nentries(&as->pt, lvl + 1); i++) {
-        temp_pt[i] = pte_dflt_val;
+    if (!zeroed || pte_dflt_val != 0) {
+        for (size_t i = 0; i < pt_nentries(&as->pt, lvl + 1); i++) {
+            temp_pt[i] = pte_dflt_val;
+        }
     }
     return temp_pt;
 }
 
+static void mem_free_pt(struct addr_space *as, paddr_t pt)
+{
+    /* Must have lock on as and va section to call */
+    if (as->pt_cache.num < AS_PT_CACHE_SIZE) {
+        as->pt_cache.pages[as->pt_cache.num++] = pt;
+    } else {
+        struct ppages ppages = mem_ppages_get(pt, 1);
+        mem_free_ppages(&ppages);
+    }
+}
+
+static inline bool pt_empty(struct addr_space *as, pte_t *pt, size_t lvl)
+{
+    for (size_t i = 0; i < pt_nentries(&as->pt, lvl); i++) {
+        if (pt[i] != 0) return false;
+    }
+    return true;
+}
+
+/**
+ * Frees the tables pointed to by the level lvl entries covering [va, top[
+ * which were left without any valid or reserved entry. Tables pointed to by
+ * the root of a shared section are shared by all cpus and are never freed.
+ */
+static void mem_reclaim_pt(struct addr_space *as, struct section *sec,
+                           size_t lvl, vaddr_t va, vaddr_t top)
+{
+    /* Must have lock on as and va section to call */
+    if (lvl + 1 >= as->pt.dscr->lvls) return;
+
+    size_t lvlsz = pt_lvlsize(&as->pt, lvl);
+    while (va < top) {
+        vaddr_t base = va & ~(lvlsz - 1);
+        vaddr_t next = base + lvlsz;
+        pte_t *pte = pt_get_pte(&as->pt, lvl, va);
+
+        if (pte_valid(pte) && pte_table(&as->pt, pte, lvl)) {
+            mem_reclaim_pt(as, sec, lvl + 1, va, min(top, next));
+
+            pte_t *pt = pt_get(&as->pt, lvl + 1, va);
+            bool ptshared = (lvl == 0) && sec->shared;
+            if (!ptshared && NUM_PAGES(pt_size(&as->pt, lvl + 1)) == 1 &&
+                pt_empty(as, pt, lvl + 1)) {
+                paddr_t pt_pa = pte_addr(pte);
+                *pte = 0;
+                fence_sync_write();
+                /**
+                 * Drop any cached walk through the table and the hypervisor
+                 * mapping through which the table itself was accessed.
+                 */
+                tlb_inv_va(as, base);
+                tlb_hyp_inv_va((vaddr_t)pt);
+                mem_free_pt(as, pt_pa);
+            }
+        }
+
+        va = next;
+    }
+}
+
 static inline bool pt_pte_mappable(struct addr_space *as, pte_t *pte, size_t lvl,
                                    size_t left, vaddr_t vaddr,
                                    paddr_t paddr)
@@ -263,7 +588,7 @@ static void mem_expand_pte(struct addr_space *as, vaddr_t va, size_t lvl)
              * Therefore this function cannot be call on the entry mapping
              * hypervisor code or data used in it (including stack).
              */
-            tlb_inv_va(&cpu()->as, va);
+            tlb_inv_va(as, va);
 
             /**
              *  Now traverse the new next level page table to replicate the
@@ -294,25 +619,214 @@ static void mem_expand_pte(struct addr_space *as, vaddr_t va, size_t lvl)
     }
 }
 
-static void mem_inflate_pt(struct addr_space *as, vaddr_t va, size_t length)
+/**
+ * A cursor walks consecutive virtual addresses of an address space,
+ * remembering the table it last used at each level. Consecutive entries are
+ * then written one after the other and tables are only looked up again when
+ * the walk crosses into the next one. The address space and section locks
+ * are held from mem_cursor_begin to mem_cursor_end, which makes all the
+ * writes visible at once.
+ */
+#define MEM_CURSOR_LVLS (4)
+
+struct mem_cursor {
+    struct addr_space *as;
+    struct section *sec;
+    vaddr_t start;
+    vaddr_t va;
+    struct {
+        pte_t *pt;
+        vaddr_t va;
+    } lvl[MEM_CURSOR_LVLS];
+};
+
+enum mem_cursor_mode {
+    /* the largest blocks the physical and virtual alignment allow */
+    MEM_CURSOR_BLOCKS,
+    /* only last level pages, as needed for coloring */
+    MEM_CURSOR_PAGES,
+    /* the largest blocks, each backed by newly allocated physical pages */
+    MEM_CURSOR_ALLOC,
+};
+
+static void mem_cursor_init(struct mem_cursor *cur, struct addr_space *as,
+                            vaddr_t va)
 {
-    /* Must have lock on as and va section to call */
+    *cur = (struct mem_cursor){.as = as, .start = va, .va = va};
+}
 
-    /**
-     * For each level in the pt, expand each entry in the specified range
-     * as a next level page table.
-     */
-    for (size_t lvl = 0; lvl < as->pt.dscr->lvls - 1; lvl++) {
-        vaddr_t vaddr = va;
+/* Forgets the tables from level lvl on, after their parent entries changed */
+static inline void mem_cursor_drop(struct mem_cursor *cur, size_t lvl)
+{
+    for (; lvl < MEM_CURSOR_LVLS; lvl++) {
+        cur->lvl[lvl].pt = NULL;
+    }
+}
+
+/**
+ * Returns the level lvl entry translating va. Unless lvl is 0, the entry of
+ * the previous level must point to a table.
+ */
+static pte_t *mem_cursor_pte(struct mem_cursor *cur, size_t lvl, vaddr_t va)
+{
+    struct page_table *pt = &cur->as->pt;
+    size_t index = pt_getpteindex_by_va(pt, va, lvl);
+
+    if (lvl == 0) {
+        return &pt->root[index];
+    } else if (lvl >= MEM_CURSOR_LVLS) {
+        return pt_get_pte(pt, lvl, va);
+    }
+
+    /* a level lvl table translates 2^lvl_wdt bytes */
+    size_t wdt = pt->dscr->lvl_wdt[lvl];
+    if (cur->lvl[lvl].pt == NULL || (va >> wdt) != (cur->lvl[lvl].va >> wdt)) {
+        pte_t *table = pt_get(pt, lvl, va);
+        if (table == NULL) return NULL;
+        cur->lvl[lvl].pt = table;
+        cur->lvl[lvl].va = va;
+    }
+
+    return &cur->lvl[lvl].pt[index];
+}
+
+/**
+ * Returns the valid entry that maps va, at whichever level it is, or NULL if
+ * va is not mapped.
+ */
+static pte_t *mem_cursor_leaf(struct mem_cursor *cur, vaddr_t va, size_t *lvl)
+{
+    struct page_table *pt = &cur->as->pt;
+
+    for (size_t i = 0; i < pt->dscr->lvls; i++) {
+        pte_t *pte = mem_cursor_pte(cur, i, va);
+        if (pte == NULL || !pte_valid(pte)) {
+            break;
+        } else if (!pte_table(pt, pte, i)) {
+            *lvl = i;
+            return pte;
+        }
+    }
+
+    return NULL;
+}
+
+static bool mem_cursor_begin(struct mem_cursor *cur, struct addr_space *as,
+                             vaddr_t va, size_t num_pages)
+{
+    struct section *sec = mem_find_sec(as, va);
+
+    if ((sec == NULL) ||
+        (sec != mem_find_sec(as, va + num_pages * PAGE_SIZE - 1))) {
+        return false;
+    }
+
+    mem_cursor_init(cur, as, va);
+    cur->sec = sec;
+
+    spin_lock(&as->lock);
+    if (sec->shared) spin_lock(&sec->lock);
+
+    return true;
+}
+
+/**
+ * Maps num_pages at the cursor to the physical pages starting at paddr,
+ * or to newly allocated ones, and moves the cursor past them.
+ */
+static void mem_cursor_map(struct mem_cursor *cur, paddr_t paddr,
+                           size_t num_pages, mem_flags_t flags,
+                           enum mem_cursor_mode mode)
+{
+    struct addr_space *as = cur->as;
+    size_t last_lvl = as->pt.dscr->lvls - 1;
+    bool alloc = (mode == MEM_CURSOR_ALLOC);
+    vaddr_t vaddr = cur->va;
+    size_t count = 0;
+
+    while (count < num_pages) {
+        size_t lvl = 0;
+        pte_t *pte = mem_cursor_pte(cur, lvl, vaddr);
+
+        /* go down until an entry can map the next block */
+        while (!(pt_lvl_terminal(&as->pt, lvl) &&
+                 (mode != MEM_CURSOR_PAGES || lvl == last_lvl) &&
+                 pt_pte_mappable(as, pte, lvl, num_pages - count, vaddr,
+                                 alloc ? 0 : paddr))) {
+            if (lvl == last_lvl) {
+                ERROR("trying to override previous mapping");
+            } else if (!pte_valid(pte)) {
+                mem_alloc_pt(as, pte, lvl, vaddr);
+                mem_cursor_drop(cur, lvl + 1);
+            } else if (!pte_table(&as->pt, pte, lvl)) {
+                ERROR("trying to override previous mapping");
+            }
+            pte = mem_cursor_pte(cur, ++lvl, vaddr);
+        }
+
+        size_t entry = pt_getpteindex_by_va(&as->pt, vaddr, lvl);
+        size_t nentries = pt_nentries(&as->pt, lvl);
         size_t lvlsz = pt_lvlsize(&as->pt, lvl);
-        while (vaddr < (va + length)) {
-            mem_expand_pte(as, vaddr, lvl);
+        pte_type_t type = pt_page_type(&as->pt, lvl);
+
+        /* then fill the following entries of the same table */
+        while ((entry < nentries) && !pte_valid(pte) &&
+               (num_pages - count >= lvlsz / PAGE_SIZE)) {
+            if (alloc) {
+                struct ppages temp =
+                    mem_alloc_ppages_place(as->colors, lvlsz / PAGE_SIZE,
+                                           true, &as->placement);
+                if (temp.num_pages < lvlsz / PAGE_SIZE) {
+                    if (lvl == last_lvl) {
+                        // TODO: free previously allocated pages
+                        ERROR("failed to alloc physical pages");
+                    }
+                    /* map this block with smaller ones */
+                    mem_alloc_pt(as, pte, lvl, vaddr);
+                    mem_cursor_drop(cur, lvl + 1);
+                    break;
+                }
+                paddr = temp.base;
+            }
+            pte_set(pte, paddr, type, flags);
             vaddr += lvlsz;
+            paddr += lvlsz;
+            count += lvlsz / PAGE_SIZE;
+            pte++;
+            entry++;
         }
     }
+
+    cur->va = vaddr;
 }
 
-vaddr_t mem_alloc_vpage(struct addr_space *as, enum AS_SEC section,
+static void mem_cursor_end(struct mem_cursor *cur)
+{
+    struct addr_space *as = cur->as;
+    struct section *sec = cur->sec;
+
+    fence_sync();
+
+    /**
+     * Only invalid entries were replaced, so other cpus, even those sharing
+     * the section, hold nothing stale unless the arch caches invalid entries.
+     */
+    if (TLB_ARCH_CACHES_INVALID && cur->va > cur->start) {
+        tlb_inv_range(as, cur->start, cur->va - cur->start, PAGE_SIZE,
+                      as->type == AS_HYP && !sec->shared);
+    }
+
+    if (sec->shared) spin_unlock(&sec->lock);
+    spin_unlock(&as->lock);
+}
+
+/**
+ * Finds free space by walking the page tables, reserving it with the
+ * PTE_RSW_RSRV software bit. Only used for address spaces built during
+ * hypervisor coloring, which have no free extents of their own, and for
+ * sections whose free ranges did not fit in their extents.
+ */
+static vaddr_t mem_alloc_vpage_pt(struct addr_space *as, enum AS_SEC section,
                             vaddr_t at, size_t n)
 {
     size_t lvl = 0;
@@ -416,91 +930,346 @@ vaddr_t mem_alloc_vpage(struct addr_space *as, enum AS_SEC section,
     return vpage;
 }
 
-void mem_unmap(struct addr_space *as, vaddr_t at, size_t num_pages,
-                    bool free_ppages)
+#define VAS_INVALID_VPN ((size_t)-1)
+
+static struct vas_extents *mem_sec_vas(struct addr_space *as,
+                                       struct section *sec)
 {
-    vaddr_t vaddr = at;
-    vaddr_t top = at + (num_pages * PAGE_SIZE);
-    size_t lvl = 0;
+    if (as->type == AS_HYP_CPY) return NULL;
+    struct vas_extents *vas = sec->shared ? &sec->vas : &as->vas;
+    return vas->overflow ? NULL : vas;
+}
 
-    spin_lock(&as->lock);
+static void vas_remove(struct vas_extents *vas, size_t i)
+{
+    for (; i + 1 < vas->num; i++) {
+        vas->ext[i] = vas->ext[i + 1];
+    }
+    vas->num--;
+}
 
-    struct section *sec = mem_find_sec(as, at);
-    if (sec->shared) spin_lock(&sec->lock);
+/* Fails, leaving the extents untouched, if they are all in use */
+static bool vas_insert(struct vas_extents *vas, size_t i, size_t first,
+                       size_t last)
+{
+    if (vas->num == VAS_EXTENTS_NUM) {
+        return false;
+    }
 
-    while (vaddr < top) {
-        pte_t *pte = pt_get_pte(&as->pt, lvl, vaddr);
-        if (pte == NULL) {
-            ERROR("invalid pte while freeing vpages");
-        } else if (!pte_valid(pte)) {
-            size_t lvlsz = pt_lvlsize(&as->pt, lvl);
-            vaddr += lvlsz;
-        } else if (pte_table(&as->pt, pte, lvl)) {
-            lvl++;
-        } else {
-            size_t entry = pt_getpteindex(&as->pt, pte, lvl);
-            size_t nentries = pt_nentries(&as->pt, lvl);
-            size_t lvlsz = pt_lvlsize(&as->pt, lvl);
+    for (size_t j = vas->num; j > i; j--) {
+        vas->ext[j] = vas->ext[j - 1];
+    }
+    vas->ext[i].first = first;
+    vas->ext[i].last = last;
+    vas->num++;
 
-            while ((entry < nentries) && (vaddr < top)) {
-                if (!pte_table(&as->pt, pte, lvl)) {
-                    vaddr_t vpage_base = vaddr & ~(lvlsz - 1);
+    return true;
+}
 
-                    if (vaddr > vpage_base || top < (vpage_base + lvlsz)) {
-                        mem_expand_pte(as, vaddr, lvl);
-                        lvl++;
-                        break;
-                    }
+/* index of the first free range ending at or after vpn */
+static size_t vas_find(struct vas_extents *vas, size_t vpn)
+{
+    size_t lo = 0;
+    size_t hi = vas->num;
 
-                    if (free_ppages) {
-                        paddr_t paddr = pte_addr(pte);
-                        struct ppages ppages =
-                            mem_ppages_get(paddr, lvlsz / PAGE_SIZE);
-                        mem_free_ppages(&ppages);
-                    }
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (vas->ext[mid].last < vpn) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
 
-                    *pte = 0;
-                    tlb_inv_va(&cpu()->as, vaddr);
+    return lo;
+}
 
-                } else {
-                    break;
-                }
-                pte++;
-                entry++;
-                vaddr += lvlsz;
-            }
+static size_t vas_alloc(struct vas_extents *vas, size_t at, size_t n)
+{
+    size_t i = 0;
 
-            if (entry == nentries) {
-                lvl--;
-            }
+    if (at == VAS_INVALID_VPN) {
+        while (i < vas->num && (vas->ext[i].last - vas->ext[i].first) < n - 1) {
+            i++;
+        }
+        if (i == vas->num) return VAS_INVALID_VPN;
+        at = vas->ext[i].first;
+    } else {
+        i = vas_find(vas, at);
+        if (i == vas->num || vas->ext[i].first > at ||
+            vas->ext[i].last - at < n - 1) {
+            return VAS_INVALID_VPN;
+        }
+    }
 
-            /**
-             * TODO: check if the current pt is now empty and if so,
-             * free it too up to the root.
-             */
+    size_t first = vas->ext[i].first;
+    size_t last = vas->ext[i].last;
+    if (first < at && at + n - 1 < last) {
+        /* splitting the range needs an extra extent */
+        if (!vas_insert(vas, i + 1, at + n, last)) {
+            return VAS_INVALID_VPN;
         }
+        vas->ext[i].last = at - 1;
+    } else if (first < at) {
+        vas->ext[i].last = at - 1;
+    } else if (at + n - 1 < last) {
+        vas->ext[i].first = at + n;
+    } else {
+        vas_remove(vas, i);
     }
 
-    if (sec->shared) spin_unlock(&sec->lock);
+    return at;
+}
 
-    spin_unlock(&as->lock);
+/**
+ * Fails if the range is not adjacent to any free one and all extents are in
+ * use, in which case its pages stay allocated.
+ */
+static bool vas_free(struct vas_extents *vas, size_t first, size_t last)
+{
+    size_t i = vas_find(vas, first > 0 ? first - 1 : 0);
+
+    /* merge with every range overlapping or adjacent to the new one */
+    while (i < vas->num && vas->ext[i].first <= last + 1) {
+        first = min(first, vas->ext[i].first);
+        last = max(last, vas->ext[i].last);
+        vas_remove(vas, i);
+    }
+
+    return vas_insert(vas, i, first, last);
 }
 
-bool mem_map(struct addr_space *as, vaddr_t va, struct ppages *ppages,
-            size_t num_pages, mem_flags_t flags)
+static bool mem_vas_scan(struct addr_space *as, struct vas_extents *vas,
+                         size_t lvl, vaddr_t va, vaddr_t last, size_t *next)
 {
-    size_t count = 0;
-    pte_t *pte = NULL;
-    vaddr_t vaddr = va & ~(PAGE_SIZE - 1);
+    size_t lvlsz = pt_lvlsize(&as->pt, lvl);
 
-    struct section *sec = mem_find_sec(as, vaddr);
+    while (true) {
+        vaddr_t end = min(last, (va & ~(lvlsz - 1)) + (lvlsz - 1));
+        pte_t *pte = pt_get_pte(&as->pt, lvl, va);
+
+        if (pte_valid(pte) && pte_table(&as->pt, pte, lvl)) {
+            if (!mem_vas_scan(as, vas, lvl + 1, va, end, next)) {
+                return false;
+            }
+        } else if (pte_valid(pte) || pte_check_rsw(pte, PTE_RSW_RSRV)) {
+            if (*next < va / PAGE_SIZE &&
+                !vas_insert(vas, vas->num, *next, (va / PAGE_SIZE) - 1)) {
+                return false;
+            }
+            *next = (end / PAGE_SIZE) + 1;
+        }
+
+        if (end == last) break;
+        va = end + 1;
+    }
+
+    return true;
+}
+
+/**
+ * If the free ranges do not fit in the extents, the page tables are left as
+ * the only record of the section's free space and false is returned.
+ */
+static bool mem_vas_seed(struct addr_space *as, struct section *sec,
+                         struct vas_extents *vas)
+{
+    /* don't go past what the root table can translate */
+    vaddr_t last = sec->end;
+    size_t width = as->pt.dscr->lvl_wdt[0];
+    if (width < (sizeof(vaddr_t) * 8) && ((last - sec->beg) >> width) != 0) {
+        last = sec->beg + ((1UL << width) - 1);
+    }
 
-    if ((sec == NULL) || (sec != mem_find_sec(as, vaddr + num_pages * PAGE_SIZE - 1)))
+    size_t next = sec->beg / PAGE_SIZE;
+    vas->num = 0;
+    if (!mem_vas_scan(as, vas, 0, sec->beg, last, &next) ||
+        (next <= last / PAGE_SIZE &&
+         !vas_insert(vas, vas->num, next, last / PAGE_SIZE))) {
+        vas->overflow = true;
         return false;
+    }
+    vas->seeded = true;
+
+    return true;
+}
+
+vaddr_t mem_alloc_vpage(struct addr_space *as, enum AS_SEC section,
+                            vaddr_t at, size_t n)
+{
+    struct section *sec = &sections[as->type].sec[section];
+    struct vas_extents *vas = mem_sec_vas(as, sec);
+
+    if (vas == NULL) {
+        return mem_alloc_vpage_pt(as, section, at, n);
+    }
+
+    if (n == 0 || (at != INVALID_VA && (sec != mem_find_sec(as, at) ||
+                                        !IS_ALIGNED(at, PAGE_SIZE)))) {
+        return INVALID_VA;
+    }
 
     spin_lock(&as->lock);
     if (sec->shared) spin_lock(&sec->lock);
 
+    if (!vas->seeded && !mem_vas_seed(as, sec, vas)) {
+        if (sec->shared) spin_unlock(&sec->lock);
+        spin_unlock(&as->lock);
+        return mem_alloc_vpage_pt(as, section, at, n);
+    }
+    size_t vpn = vas_alloc(vas, at == INVALID_VA ? VAS_INVALID_VPN : at / PAGE_SIZE, n);
+
+    if (sec->shared) spin_unlock(&sec->lock);
+    spin_unlock(&as->lock);
+
+    return vpn == VAS_INVALID_VPN ? INVALID_VA : vpn * PAGE_SIZE;
+}
+
+/**
+ * Pages unmapped by mem_unmap can only go back to the pools once no TLB
+ * still holds a translation to them, so they are kept as a few physically
+ * contiguous runs until the next flush.
+ */
+#define MEM_UNMAP_FREE_RUNS (8)
+
+struct mem_unmap_batch {
+    struct tlb_batch tlb;
+    size_t num_runs;
+    struct ppages runs[MEM_UNMAP_FREE_RUNS];
+};
+
+static void mem_unmap_flush(struct mem_unmap_batch *batch)
+{
+    tlb_batch_flush(&batch->tlb);
+    for (size_t i = 0; i < batch->num_runs; i++) {
+        mem_free_ppages(&batch->runs[i]);
+    }
+    batch->num_runs = 0;
+}
+
+static void mem_unmap_free(struct mem_unmap_batch *batch, paddr_t paddr,
+                           size_t num_pages)
+{
+    if (batch->num_runs > 0) {
+        struct ppages *run = &batch->runs[batch->num_runs - 1];
+        if (run->base + (run->num_pages * PAGE_SIZE) == paddr) {
+            run->num_pages += num_pages;
+            return;
+        }
+    }
+
+    if (batch->num_runs == MEM_UNMAP_FREE_RUNS) {
+        mem_unmap_flush(batch);
+    }
+    batch->runs[batch->num_runs++] = mem_ppages_get(paddr, num_pages);
+}
+
+/**
+ * If free_va is false the virtual range stays allocated, so that it can be
+ * mapped again.
+ */
+static void mem_unmap_range(struct addr_space *as, vaddr_t at,
+                            size_t num_pages, bool free_ppages, bool free_va)
+{
+    vaddr_t vaddr = at;
+    vaddr_t top = at + (num_pages * PAGE_SIZE);
+    size_t lvl = 0;
+    struct mem_unmap_batch batch = {.num_runs = 0};
+    struct mem_cursor cur;
+
+    if (num_pages == 0) return;
+
+    if (!mem_cursor_begin(&cur, as, at, num_pages)) {
+        ERROR("unmapping pages outside of a section");
+    }
+    struct section *sec = cur.sec;
+    struct vas_extents *vas = mem_sec_vas(as, sec);
+    /* without extents, a range that stays allocated is reserved in place */
+    bool reserve = !free_va && (vas == NULL || !vas->seeded);
+
+    tlb_batch_init(&batch.tlb, as, as->type == AS_HYP && !sec->shared);
+
+    while (vaddr < top) {
+        pte_t *pte = mem_cursor_pte(&cur, lvl, vaddr);
+        if (pte == NULL) {
+            ERROR("invalid pte while freeing vpages");
+        } else if (!pte_valid(pte) &&
+                   (reserve || !pte_check_rsw(pte, PTE_RSW_RSRV))) {
+            /* reserved entries are only released along with their range */
+            size_t lvlsz = pt_lvlsize(&as->pt, lvl);
+            vaddr += lvlsz;
+        } else if (pte_table(&as->pt, pte, lvl)) {
+            lvl++;
+        } else {
+            size_t entry = pt_getpteindex(&as->pt, pte, lvl);
+            size_t nentries = pt_nentries(&as->pt, lvl);
+            size_t lvlsz = pt_lvlsize(&as->pt, lvl);
+
+            while ((entry < nentries) && (vaddr < top)) {
+                if (!pte_table(&as->pt, pte, lvl)) {
+                    vaddr_t vpage_base = vaddr & ~(lvlsz - 1);
+
+                    if (vaddr > vpage_base || top < (vpage_base + lvlsz)) {
+                        mem_expand_pte(as, vaddr, lvl);
+                        mem_cursor_drop(&cur, lvl + 1);
+                        lvl++;
+                        break;
+                    }
+
+                    if (pte_valid(pte)) {
+                        if (free_ppages) {
+                            mem_unmap_free(&batch, pte_addr(pte),
+                                           lvlsz / PAGE_SIZE);
+                        }
+                        tlb_batch_add(&batch.tlb, vaddr, lvlsz);
+                    }
+
+                    *pte = 0;
+                    if (reserve) {
+                        pte_set_rsw(pte, PTE_RSW_RSRV);
+                    }
+
+                } else {
+                    break;
+                }
+                pte++;
+                entry++;
+                vaddr += lvlsz;
+            }
+
+            if (entry == nentries) {
+                lvl--;
+            }
+        }
+    }
+
+    mem_unmap_flush(&batch);
+    mem_reclaim_pt(as, sec, 0, at, top);
+
+    if (free_va && vas != NULL && vas->seeded &&
+        !vas_free(vas, at / PAGE_SIZE, (at / PAGE_SIZE) + num_pages - 1)) {
+        WARNING("out of free extents, virtual pages 0x%lx-0x%lx stay in use",
+                (unsigned long)at, (unsigned long)(top - 1));
+    }
+
+    mem_cursor_end(&cur);
+}
+
+void mem_unmap(struct addr_space *as, vaddr_t at, size_t num_pages,
+                    bool free_ppages)
+{
+    mem_unmap_range(as, at, num_pages, free_ppages, true);
+}
+
+bool mem_map(struct addr_space *as, vaddr_t va, struct ppages *ppages,
+            size_t num_pages, mem_flags_t flags)
+{
+    struct mem_cursor cur;
+
+    if (!mem_cursor_begin(&cur, as, va & ~(PAGE_SIZE - 1), num_pages)) {
+        return false;
+    }
+
     /**
      * TODO check if entry is reserved. Unrolling mapping if something
      * goes wrong.
@@ -508,7 +1277,8 @@ bool mem_map(struct addr_space *as, vaddr_t va, struct ppages *ppages,
 
     struct ppages temp_ppages;
     if (ppages == NULL && !all_clrs(as->colors)) {
-        temp_ppages = mem_alloc_ppages(as->colors, num_pages, false);
+        temp_ppages = mem_alloc_ppages_place(as->colors, num_pages, false,
+                                             &as->placement);
         if (temp_ppages.num_pages < num_pages) {
             ERROR("failed to alloc colored physical pages");
         }
@@ -517,75 +1287,78 @@ bool mem_map(struct addr_space *as, vaddr_t va, struct ppages *ppages,
 
     if (ppages && !all_clrs(ppages->colors)) {
         size_t index = 0;
-        mem_inflate_pt(as, vaddr, num_pages * PAGE_SIZE);
         for (size_t i = 0; i < ppages->num_pages; i++) {
-            pte = pt_get_pte(&as->pt, as->pt.dscr->lvls - 1, vaddr);
             index = pp_next_clr(ppages->base, index, ppages->colors);
-            paddr_t paddr = ppages->base + (index * PAGE_SIZE);
-            pte_set(pte, paddr, PTE_PAGE, flags);
-            vaddr += PAGE_SIZE;
+            mem_cursor_map(&cur, ppages->base + (index * PAGE_SIZE), 1, flags,
+                           MEM_CURSOR_PAGES);
             index++;
         }
+    } else if (ppages) {
+        mem_cursor_map(&cur, ppages->base, num_pages, flags, MEM_CURSOR_BLOCKS);
     } else {
-        paddr_t paddr = ppages ? ppages->base : 0;
-        while (count < num_pages) {
-            size_t lvl = 0;
-            for (lvl = 0; lvl < as->pt.dscr->lvls; lvl++) {
-                pte = pt_get_pte(&as->pt, lvl, vaddr);
-                if (pt_lvl_terminal(&as->pt, lvl)) {
-                    if (pt_pte_mappable(as, pte, lvl, num_pages - count,
-                                        vaddr, ppages ? paddr : 0)) {
-                        break;
-                    } else if (!pte_valid(pte)) {
-                        mem_alloc_pt(as, pte, lvl, vaddr);
-                    } else if (!pte_table(&as->pt, pte, lvl)) {
-                        ERROR("trying to override previous mapping");
-                    }
-                }
-            }
+        mem_cursor_map(&cur, 0, num_pages, flags, MEM_CURSOR_ALLOC);
+    }
 
-            size_t entry = pt_getpteindex(&as->pt, pte, lvl);
-            size_t nentries = pt_nentries(&as->pt, lvl);
-            size_t lvlsz = pt_lvlsize(&as->pt, lvl);
+    mem_cursor_end(&cur);
 
-            while ((entry < nentries) && (count < num_pages) &&
-                   (num_pages - count >= lvlsz / PAGE_SIZE)) {
-                if (ppages == NULL) {
-                    struct ppages temp =
-                        mem_alloc_ppages(as->colors, lvlsz / PAGE_SIZE, true);
-                    if (temp.num_pages < lvlsz / PAGE_SIZE) {
-                        if (lvl == (as->pt.dscr->lvls - 1)) {
-                            // TODO: free previously allocated pages
-                            ERROR("failed to alloc physical pages");
-                        } else {
-                            pte = pt_get_pte(&as->pt, lvl, vaddr);
-                            if (!pte_valid(pte)) {
-                                mem_alloc_pt(as, pte, lvl, vaddr);
-                            }
-                            break;
-                        }
-                    }
-                    paddr = temp.base;
-                }
-                pte_set(pte, paddr, pt_page_type(&as->pt, lvl), flags);
-                vaddr += lvlsz;
-                paddr += lvlsz;
-                count += lvlsz / PAGE_SIZE;
-                pte++;
-                entry++;
-            }
-        }
-    }
+    return true;
+}
 
-    fence_sync();
+/**
+ * Upper bound, in pages, of the memory mem_map_reclr holds on top of the
+ * original image, and size of its hypervisor windows.
+ */
+#ifndef MEM_RECLR_WINDOW
+#define MEM_RECLR_WINDOW (64)
+#endif
+
+/**
+ * The image pages mem_map_reclr is currently moving: the next src pages
+ * outside the vm colors were copied to the dst colored pages, of which the
+ * first used are already mapped to the vm.
+ */
+struct mem_reclr_window {
+    vaddr_t src_va;
+    vaddr_t dst_va;
+    struct ppages src;
+    struct ppages dst;
+    size_t used;
+    size_t index;
+};
 
-    if (sec->shared) {
-        spin_unlock(&sec->lock);
-        // TODO tlb shootdown?
+/**
+ * Moves the num_pages image pages outside the vm colors from paddr on to
+ * newly allocated colored pages, through the hypervisor windows, and gives
+ * the old pages back.
+ */
+static void mem_reclr_window_fill(struct mem_reclr_window *win,
+                                  struct addr_space *as, paddr_t paddr,
+                                  size_t num_pages)
+{
+    win->src = (struct ppages){
+        .base = paddr, .num_pages = num_pages, .colors = ~as->colors};
+    win->dst = mem_alloc_ppages(as->colors, num_pages, false);
+    if (win->dst.num_pages < num_pages) {
+        ERROR("failed to alloc colored pages to recolor image");
     }
-    spin_unlock(&as->lock);
 
-    return true;
+    mem_map(&cpu()->as, win->src_va, &win->src, num_pages, PTE_HYP_FLAGS);
+    mem_map(&cpu()->as, win->dst_va, &win->dst, num_pages, PTE_HYP_FLAGS);
+
+    memcpy((void*)win->dst_va, (void*)win->src_va, num_pages * PAGE_SIZE);
+
+    /**
+     * Flush the newly allocated colored pages to which parts of the
+     * image was copied, and might stayed in the cache system.
+     */
+    cache_flush_range(win->dst_va, num_pages * PAGE_SIZE);
+
+    mem_unmap_range(&cpu()->as, win->src_va, num_pages, false, false);
+    mem_unmap_range(&cpu()->as, win->dst_va, num_pages, false, false);
+    mem_free_ppages(&win->src);
+
+    win->used = 0;
+    win->index = 0;
 }
 
 bool mem_map_reclr(struct addr_space *as, vaddr_t va, struct ppages *ppages,
@@ -597,8 +1370,6 @@ bool mem_map_reclr(struct addr_space *as, vaddr_t va, struct ppages *ppages,
 
     /**
      * Count how many pages are not colored in original images.
-     * Allocate the necessary colored pages.
-     * Mapped onto hypervisor address space.
      */
     size_t reclrd_num =
         num_pages / (COLOR_NUM * COLOR_SIZE) * COLOR_SIZE *
@@ -618,73 +1389,66 @@ bool mem_map_reclr(struct addr_space *as, vaddr_t va, struct ppages *ppages,
         return mem_map(as, va, ppages, num_pages, flags);
     }
 
-    vaddr_t reclrd_va_base =
-        mem_alloc_vpage(&cpu()->as, SEC_HYP_VM, INVALID_VA, reclrd_num);
-    struct ppages reclrd_ppages = mem_alloc_ppages(as->colors, reclrd_num, false);
-    mem_map(&cpu()->as, reclrd_va_base, &reclrd_ppages, reclrd_num, PTE_HYP_FLAGS);
-
     /**
-     * Map original image onto hypervisor address space.
+     * The pages to recolor are moved at most MEM_RECLR_WINDOW at a time,
+     * always through the same hypervisor windows, and freed right after,
+     * so the image is never mapped as a whole nor duplicated.
      */
-    vaddr_t phys_va_base = mem_alloc_vpage(&cpu()->as, SEC_HYP_VM, INVALID_VA, num_pages);
-    mem_map(&cpu()->as, phys_va_base, ppages, num_pages, PTE_HYP_FLAGS);
+    size_t window = min((size_t)MEM_RECLR_WINDOW, reclrd_num);
+    size_t reclrd_left = reclrd_num;
+    struct mem_reclr_window win = {
+        .src_va = mem_alloc_vpage(&cpu()->as, SEC_HYP_VM, INVALID_VA, window),
+        .dst_va = mem_alloc_vpage(&cpu()->as, SEC_HYP_VM, INVALID_VA, window),
+    };
+    if (win.src_va == INVALID_VA || win.dst_va == INVALID_VA) {
+        ERROR("failed to alloc recoloring windows");
+    }
 
-    pte_t *pte = NULL;
-    vaddr_t vaddr = va & ~(PAGE_SIZE - 1);
+    struct mem_cursor cur;
     paddr_t paddr = ppages->base;
-    vaddr_t clrd_vaddr = reclrd_va_base;
-    vaddr_t phys_va = phys_va_base;
-    size_t index = 0;
+
+    if (!mem_cursor_begin(&cur, as, va & ~(PAGE_SIZE - 1), num_pages)) {
+        ERROR("recoloring pages outside of a section");
+    }
 
     /**
-     * Inflate reserved page tables to the last level. This assumes
-     * coloring always needs the finest grained mapping possible.
+     * This assumes coloring always needs the finest grained mapping
+     * possible.
      */
-    mem_inflate_pt(as, vaddr, num_pages * PAGE_SIZE);
-
     for (size_t i = 0; i < num_pages; i++) {
-        pte = pt_get_pte(&as->pt, as->pt.dscr->lvls - 1, vaddr);
-
         /**
          * If image page is already color, just map it.
-         * Otherwise first copy it to the previously allocated pages.
+         * Otherwise map its copy, moving the next window first if needed.
          */
         if (bitmap_get((bitmap_t*)&as->colors,
                        ((i + clr_offset) / COLOR_SIZE % COLOR_NUM))) {
-            pte_set(pte, paddr, PTE_PAGE, flags);
+            mem_cursor_map(&cur, paddr, 1, flags, MEM_CURSOR_PAGES);
 
         } else {
-            memcpy((void*)clrd_vaddr, (void*)phys_va, PAGE_SIZE);
-            index = pp_next_clr(reclrd_ppages.base, index, as->colors);
-            paddr_t clrd_paddr = reclrd_ppages.base + (index * PAGE_SIZE);
-            pte_set(pte, clrd_paddr, PTE_PAGE, flags);
+            if (win.used == win.dst.num_pages) {
+                size_t n = min(window, reclrd_left);
+                if (n == 0) {
+                    ERROR("more pages to recolor than expected");
+                }
+                mem_reclr_window_fill(&win, as, paddr, n);
+                reclrd_left -= n;
+            }
 
-            clrd_vaddr += PAGE_SIZE;
-            index++;
+            win.index = pp_next_clr(win.dst.base, win.index, as->colors);
+            paddr_t clrd_paddr = win.dst.base + (win.index * PAGE_SIZE);
+            mem_cursor_map(&cur, clrd_paddr, 1, flags, MEM_CURSOR_PAGES);
+
+            win.index++;
+            win.used++;
         }
         paddr += PAGE_SIZE;
-        phys_va += PAGE_SIZE;
-        vaddr += PAGE_SIZE;
     }
 
-    /**
-     * Flush the newly allocated colored pages to which parts of the
-     * image was copied, and might stayed in the cache system.
-     */
-    cache_flush_range(reclrd_va_base, reclrd_num * PAGE_SIZE);
-
-    /**
-     * Free the uncolored pages of the original image.
-     */
-    struct ppages unused_pages = {
-        .base = ppages->base,
-        .num_pages = reclrd_num,
-        .colors = ~as->colors
-    };
-    mem_free_ppages(&unused_pages);
+    mem_cursor_end(&cur);
 
-    mem_unmap(&cpu()->as, reclrd_va_base, reclrd_num, false);
-    mem_unmap(&cpu()->as, phys_va_base, num_pages, false);
+    /* the windows are no longer mapped, this only gives back their range */
+    mem_unmap(&cpu()->as, win.src_va, window, false);
+    mem_unmap(&cpu()->as, win.dst_va, window, false);
 
     return true;
 }
@@ -696,13 +1460,21 @@ vaddr_t mem_map_cpy(struct addr_space *ass, struct addr_space *asd, vaddr_t vas,
     size_t base_vad = _vad;
     size_t count = 0;
     size_t to_map = num_pages * PAGE_SIZE;
+    struct mem_cursor src;
+    struct mem_cursor dst;
+
+    /* the source is only looked up, no need to lock it */
+    mem_cursor_init(&src, ass, vas);
+    if (!mem_cursor_begin(&dst, asd, _vad, num_pages)) {
+        ERROR("can't map copy outside of a section");
+    }
 
     while (count < num_pages) {
         size_t lvl = 0;
-        pte_t *pte = pt_get_pte(&ass->pt, lvl, vas);
+        pte_t *pte = mem_cursor_pte(&src, lvl, vas);
         while(!pte_page(&ass->pt, pte, lvl)) {
             lvl += 1;
-            pte = pt_get_pte(&ass->pt, lvl, vas);
+            pte = mem_cursor_pte(&src, lvl, vas);
         }
         size_t lvl_size = pt_lvlsize(&ass->pt, lvl);
         size_t size = lvl_size;
@@ -711,17 +1483,245 @@ vaddr_t mem_map_cpy(struct addr_space *ass, struct addr_space *asd, vaddr_t vas,
         }
         size_t npages = NUM_PAGES(size);
         paddr_t pa = pte_addr(pte) + (vas - ALIGN_FLOOR(vas, lvl_size));
-        struct ppages pages = mem_ppages_get(pa, npages);
-        mem_map(asd, _vad, &pages, npages, PTE_HYP_FLAGS);
+        mem_cursor_map(&dst, pa, npages, PTE_HYP_FLAGS, MEM_CURSOR_BLOCKS);
         _vad += size;
         vas += size;
         count += npages;
         to_map -= size;
     }
 
+    mem_cursor_end(&dst);
+
     return base_vad;
 }
 
+/**
+ * Address of the next page of ppages, the one at or after *index in its
+ * colors, and moves *index past it.
+ */
+static inline paddr_t pp_next_page(struct ppages *ppages, size_t *index)
+{
+    if (!all_clrs(ppages->colors)) {
+        *index = pp_next_clr(ppages->base, *index, ppages->colors);
+    }
+    return ppages->base + ((*index)++ * PAGE_SIZE);
+}
+
+/**
+ * Points the num_pages last level entries of a window set up by
+ * mem_recolor_begin at the pages of ppages, or all of them at the parking
+ * page if ppages is NULL. The window's tables already exist, so this
+ * allocates nothing and can't fail.
+ */
+static void mem_recolor_window(struct mem_recolor *rclr, vaddr_t window,
+                               struct ppages *ppages, size_t num_pages)
+{
+    struct addr_space *as = &cpu()->as;
+    size_t last_lvl = as->pt.dscr->lvls - 1;
+    pte_type_t type = pt_page_type(&as->pt, last_lvl);
+    vaddr_t top = window + (num_pages * PAGE_SIZE);
+    struct mem_cursor cur;
+    size_t index = 0;
+
+    if (!mem_cursor_begin(&cur, as, window, num_pages)) {
+        ERROR("recolor window outside of a section");
+    }
+
+    /* break before make, the entries are valid and change address */
+    for (vaddr_t va = window; va < top; va += PAGE_SIZE) {
+        *mem_cursor_pte(&cur, last_lvl, va) = 0;
+    }
+    fence_sync_write();
+    tlb_inv_range(as, window, num_pages * PAGE_SIZE, PAGE_SIZE,
+                  !cur.sec->shared);
+
+    for (vaddr_t va = window; va < top; va += PAGE_SIZE) {
+        paddr_t pa = ppages != NULL ? pp_next_page(ppages, &index) : rclr->park;
+        pte_set(mem_cursor_pte(&cur, last_lvl, va), pa, type, PTE_HYP_FLAGS);
+    }
+
+    mem_cursor_end(&cur);
+}
+
+/* Maps window pages at va, each to the parking page, one entry per page */
+static bool mem_recolor_window_init(struct mem_recolor *rclr, vaddr_t va,
+                                    size_t window)
+{
+    struct mem_cursor cur;
+
+    if (!mem_cursor_begin(&cur, &cpu()->as, va, window)) {
+        return false;
+    }
+    for (size_t i = 0; i < window; i++) {
+        mem_cursor_map(&cur, rclr->park, 1, PTE_HYP_FLAGS, MEM_CURSOR_PAGES);
+    }
+    mem_cursor_end(&cur);
+
+    return true;
+}
+
+bool mem_recolor_begin(struct mem_recolor *rclr, colormap_t colors,
+                       size_t num_pages, size_t window)
+{
+    *rclr = (struct mem_recolor){.src = INVALID_VA, .dst = INVALID_VA};
+
+    struct ppages park = mem_alloc_ppages(cpu()->as.colors, 1, false);
+    if (park.num_pages < 1) {
+        return false;
+    }
+    rclr->park = park.base;
+    rclr->window_pages = window;
+
+    rclr->pages = mem_alloc_ppages(colors, num_pages, false);
+    if (rclr->pages.num_pages < num_pages) {
+        mem_recolor_end(rclr);
+        return false;
+    }
+
+    /**
+     * Both windows stay mapped, to the parking page when not in use, until
+     * mem_recolor_end. Their tables are thus only allocated here.
+     */
+    rclr->src = mem_alloc_vpage(&cpu()->as, SEC_HYP_VM, INVALID_VA, window);
+    if (rclr->src == INVALID_VA ||
+        !mem_recolor_window_init(rclr, rclr->src, window)) {
+        mem_recolor_end(rclr);
+        return false;
+    }
+    rclr->dst = mem_alloc_vpage(&cpu()->as, SEC_HYP_VM, INVALID_VA, window);
+    if (rclr->dst == INVALID_VA ||
+        !mem_recolor_window_init(rclr, rclr->dst, window)) {
+        mem_recolor_end(rclr);
+        return false;
+    }
+
+    return true;
+}
+
+void mem_recolor_end(struct mem_recolor *rclr)
+{
+    if (rclr->pages.num_pages > 0) {
+        mem_free_ppages(&rclr->pages);
+    }
+    if (rclr->src != INVALID_VA) {
+        mem_unmap(&cpu()->as, rclr->src, rclr->window_pages, false);
+    }
+    if (rclr->dst != INVALID_VA) {
+        mem_unmap(&cpu()->as, rclr->dst, rclr->window_pages, false);
+    }
+
+    struct ppages park = mem_ppages_get(rclr->park, 1);
+    mem_free_ppages(&park);
+}
+
+/* Takes the first num_pages pages of ppages, leaving it with the rest */
+static struct ppages mem_ppages_take(struct ppages *ppages, size_t num_pages)
+{
+    struct ppages head = *ppages;
+    size_t index = 0;
+
+    head.num_pages = num_pages;
+    ppages->num_pages -= num_pages;
+
+    if (ppages->num_pages > 0) {
+        for (size_t i = 0; i < num_pages; i++) {
+            pp_next_page(&head, &index);
+        }
+        ppages->base = pp_next_page(&head, &index);
+    }
+
+    return head;
+}
+
+/* Copies the physically contiguous run at pa to the hypervisor address dst */
+static void mem_recolor_copy(struct mem_recolor *rclr, vaddr_t dst, paddr_t pa,
+                             size_t num_pages)
+{
+    struct ppages run = mem_ppages_get(pa, num_pages);
+
+    mem_recolor_window(rclr, rclr->src, &run, num_pages);
+    memcpy((void*)dst, (void*)rclr->src, num_pages * PAGE_SIZE);
+}
+
+void mem_recolor(struct addr_space *as, enum AS_SEC section, vaddr_t va,
+                 size_t num_pages, struct mem_recolor *rclr, mem_flags_t flags)
+{
+    if (num_pages > rclr->pages.num_pages || num_pages > rclr->window_pages) {
+        ERROR("recolor reservation too small");
+    }
+
+    struct ppages pages = mem_ppages_take(&rclr->pages, num_pages);
+    vaddr_t dst = rclr->dst;
+    mem_recolor_window(rclr, dst, &pages, num_pages);
+
+    /**
+     * Copy the old contents over, one physically contiguous run at a time.
+     * The new pages are mapped both here and below in color order, so the
+     * page at offset i of dst backs va + i.
+     */
+    struct mem_cursor cur;
+    vaddr_t vaddr = va;
+    vaddr_t top = va + (num_pages * PAGE_SIZE);
+    vaddr_t run_va = va;
+    paddr_t run_pa = 0;
+    size_t run_pages = 0;
+
+    mem_cursor_init(&cur, as, va);
+    spin_lock(&as->lock);
+    while (vaddr < top) {
+        size_t lvl = 0;
+        pte_t *pte = mem_cursor_leaf(&cur, vaddr, &lvl);
+        size_t lvlsz = pte != NULL ? pt_lvlsize(&as->pt, lvl) : PAGE_SIZE;
+        size_t size = min(lvlsz - (vaddr & (lvlsz - 1)), top - vaddr);
+        paddr_t pa = pte != NULL ? pte_addr(pte) + (vaddr & (lvlsz - 1)) : 0;
+
+        if (run_pages > 0 &&
+            (pte == NULL || pa != run_pa + (run_pages * PAGE_SIZE))) {
+            mem_recolor_copy(rclr, dst + (run_va - va), run_pa, run_pages);
+            run_pages = 0;
+        }
+
+        if (pte == NULL) {
+            memset((void*)(dst + (vaddr - va)), 0, size);
+        } else {
+            if (run_pages == 0) {
+                run_va = vaddr;
+                run_pa = pa;
+            }
+            run_pages += size / PAGE_SIZE;
+        }
+        vaddr += size;
+    }
+    if (run_pages > 0) {
+        mem_recolor_copy(rclr, dst + (run_va - va), run_pa, run_pages);
+    }
+    spin_unlock(&as->lock);
+
+    /**
+     * The address space may be mapped uncached, make sure the copy reached
+     * memory before it is switched over.
+     */
+    cache_flush_range(dst, num_pages * PAGE_SIZE);
+
+    /**
+     * Park the windows so the hypervisor keeps no alias to the new pages
+     * nor to the old ones, given back to the pools below.
+     */
+    mem_recolor_window(rclr, rclr->src, NULL, num_pages);
+    mem_recolor_window(rclr, dst, NULL, num_pages);
+
+    /**
+     * Remap the range, freeing the old pages. Page tables are hypervisor
+     * frames whatever the colors of the address space, so the ones reclaimed
+     * on the way are reused as they are.
+     */
+    mem_unmap(as, va, num_pages, true);
+
+    if (mem_alloc_map(as, section, &pages, va, num_pages, flags) != va) {
+        ERROR("failed to remap recolored pages");
+    }
+}
+
 void *copy_space(void *base, const size_t size, struct ppages *pages)
 {
     *pages = mem_alloc_ppages(cpu()->as.colors, NUM_PAGES(size), false);
@@ -732,6 +1732,65 @@ void *copy_space(void *base, const size_t size, struct ppages *pages)
     return (void*)va;
 }
 
+/**
+ * Each booting cpu takes an equal, page aligned, part of [0, size[ chosen by
+ * its id. Returns the part's size and its start in off.
+ */
+static size_t mem_color_chunk(size_t size, size_t *off)
+{
+    size_t id = cpu()->id;
+    size_t num_pages = NUM_PAGES(size);
+    size_t chunk = num_pages / platform.cpu_num;
+    size_t rem = num_pages % platform.cpu_num;
+    size_t first = (id * chunk) + min(id, rem);
+    size_t last = first + chunk + ((id < rem) ? 1 : 0);
+
+    *off = min(first * PAGE_SIZE, size);
+    return min(last * PAGE_SIZE, size) - *off;
+}
+
+/**
+ * Allocates colored pages for a copy of size bytes and maps them in the
+ * global section, where all cpus can reach them to copy their part.
+ */
+static vaddr_t mem_color_space(const size_t size, struct ppages *pages)
+{
+    *pages = mem_alloc_ppages(cpu()->as.colors, NUM_PAGES(size), false);
+    return mem_alloc_map(&cpu()->as, SEC_HYP_GLOBAL, pages, INVALID_VA,
+                         NUM_PAGES(size), PTE_HYP_FLAGS);
+}
+
+/* Ticks spent in each step of mem_color_hypervisor, as seen by the master */
+static struct {
+    uint64_t cpu;
+    uint64_t image;
+    uint64_t bitmap;
+    uint64_t flush;
+    uint64_t scrub;
+} color_profile;
+
+#ifdef BOOT_PROFILE
+
+static unsigned long mem_color_profile_us(uint64_t ticks)
+{
+    uint64_t freq = timer_get_freq();
+    return (unsigned long)(freq ? (ticks * 1000000) / freq : ticks);
+}
+
+void mem_color_hypervisor_report()
+{
+    INFO("hypervisor coloring on %lu cpus (%s): cpu %lu image %lu bitmap %lu "
+         "flush %lu scrub %lu",
+         (unsigned long)platform.cpu_num, timer_get_freq() ? "us" : "ticks",
+         mem_color_profile_us(color_profile.cpu),
+         mem_color_profile_us(color_profile.image),
+         mem_color_profile_us(color_profile.bitmap),
+         mem_color_profile_us(color_profile.flush),
+         mem_color_profile_us(color_profile.scrub));
+}
+
+#endif /* BOOT_PROFILE */
+
 /**
  * To have the true benefits of coloring it's necessary that not only the guest
  * images, but also the hypervisor itself, are colored.
@@ -740,18 +1799,26 @@ void *copy_space(void *base, const size_t size, struct ppages *pages)
  * this point in a new colored space, jumping into this new region and then
  * then deleting all that was allocated before.
  *
- * Some regions need to be aligned due to some ARM restraint with the pagetable
- * structure, so true coloring is actually never achieved. The drawbacks of
- * this limitation are yet to be seen, and are in need of more testing.
+ * The copies and the final scrub are split by mem_color_chunk across all
+ * booting cpus, the master only allocates and maps the shared regions.
+ *
+ * Regions that must be physically contiguous and aligned, i.e., page tables
+ * spanning multiple pages, are taken from runs of consecutive hypervisor
+ * colors. Only if the colors have no such run are they left uncolored, which
+ * mem_color_audit reports once all vms are created.
  */
 void mem_color_hypervisor(const paddr_t load_addr, struct mem_region *root_region)
 {
     volatile static pte_t shared_pte;
+    volatile static vaddr_t shared_va[3];
     vaddr_t va = INVALID_VA;
     struct cpu *cpu_new;
     struct ppages p_cpu;
     struct ppages p_image;
     struct ppages p_bitmap;
+    size_t off;
+    size_t len;
+    uint64_t ticks[6];
 
     size_t image_load_size = (size_t)(&_image_load_end - &_image_start);
     size_t image_noload_size = (size_t)(&_image_end - &_image_load_end);
@@ -764,6 +1831,8 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region *root_regio
                          PAGE_SIZE;
     colormap_t colors = config.hyp.colors;
 
+    ticks[0] = timer_get();
+
     /* Set hypervisor colors in current address space */
     cpu()->as.colors = config.hyp.colors;
 
@@ -806,15 +1875,15 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region *root_regio
         PTE_HYP_FLAGS);
 
     /*
-     * Copy the Hypervisor image and root page pool bitmap into a colored
-     * region.
+     * Copy the Hypervisor image into a colored region.
      *
-     * CPU_MASTER allocates, copies and maps the image and the root page pool
-     * bitmap on a shared space, whilst other CPUs only have to copy the image
-     * from the CPU_MASTER in order to be able to access it.
+     * CPU_MASTER allocates and maps the new image both on the new address
+     * space and, for the copy, on the current global section. Other CPUs only
+     * have to take the image page table entry from the CPU_MASTER in order to
+     * be able to access it. Then each CPU copies its part of the image.
      */
     if (cpu()->id == CPU_MASTER) {
-        copy_space(&_image_start, image_size, &p_image);
+        shared_va[0] = mem_color_space(image_size, &p_image);
         va = mem_alloc_vpage(&cpu_new->as, SEC_HYP_IMAGE,
                             (vaddr_t) &_image_start, NUM_PAGES(image_size));
 
@@ -835,6 +1904,18 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region *root_regio
     }
 
     cpu_sync_barrier(&cpu_glb_sync);
+    ticks[1] = timer_get();
+
+    /**
+     * No CPU allocates until the bitmap is copied, so whatever is copied
+     * here, apart from the synchronization objects, stays valid.
+     */
+    len = mem_color_chunk(image_size, &off);
+    memcpy((void*)(shared_va[0] + off), (void*)((vaddr_t)&_image_start + off),
+           len);
+
+    cpu_sync_barrier(&cpu_glb_sync);
+    ticks[2] = timer_get();
 
     /*
      * CPU_MASTER will also take care of mapping the configuration onto the new
@@ -845,8 +1926,9 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region *root_regio
      * allocation will be tracked.
      */
     if (cpu()->id == CPU_MASTER) {
-        /* Copy root pool bitmap */
-        copy_space((void*)root_pool->bitmap, bitmap_size, &p_bitmap);
+        mem_unmap(&cpu()->as, shared_va[0], NUM_PAGES(image_size), false);
+
+        shared_va[1] = mem_color_space(bitmap_size, &p_bitmap);
         va = mem_alloc_vpage(&cpu_new->as, SEC_HYP_GLOBAL,
                              (vaddr_t)root_pool->bitmap,
                              NUM_PAGES(bitmap_size));
@@ -859,14 +1941,23 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region *root_regio
     }
     cpu_sync_barrier(&cpu_glb_sync);
 
+    len = mem_color_chunk(bitmap_size, &off);
+    memcpy((void*)(shared_va[1] + off), (void*)((vaddr_t)root_pool->bitmap + off),
+           len);
+
+    cpu_sync_barrier(&cpu_glb_sync);
+    ticks[3] = timer_get();
+
     switch_space(cpu_new, p_root_pt_addr);
 
     /**
      * Make sure the new physical pages containing image and cpu are flushed
-     * to main memmory
+     * to main memmory. Maintenance by address reaches all CPUs' caches, so
+     * each one only flushes its part of the image.
      */
 
-    cache_flush_range((vaddr_t)&_image_start, image_size);
+    len = mem_color_chunk(image_size, &off);
+    cache_flush_range((vaddr_t)&_image_start + off, len);
     cache_flush_range((vaddr_t)&_cpu_private_beg, sizeof(struct cpu));
 
     /**
@@ -876,10 +1967,19 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region *root_regio
      * The synchronization objects are in an inconsistent state, and they need
      * to be re-initialized before they get used again, so CPUs need a way to
      * communicate between themselves without an explicit barrier. To
-     * accomplish this a static global variable is used.
+     * accomplish this a static global variable is used. It was copied while
+     * still holding the image page table entry.
      */
     if (cpu()->id == CPU_MASTER) {
         cpu_sync_init(&cpu_glb_sync, platform.cpu_num);
+        /**
+         * The free extents copied with the image describe the old address
+         * space, rebuild them from the new page tables.
+         */
+        for (size_t i = 0; i < sections[AS_HYP].sec_size; i++) {
+            sections[AS_HYP].sec[i].vas.seeded = false;
+            sections[AS_HYP].sec[i].vas.overflow = false;
+        }
         shared_pte = 0;
     } else {
         while (shared_pte != 0);
@@ -887,34 +1987,37 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region *root_regio
 
     as_init(&cpu()->as, AS_HYP, HYP_ASID, (void*)v_root_pt_addr, colors);
 
+    ticks[4] = timer_get();
+
     /*
      * Clear the old region that have been copied.
      *
      * CPU space regions and Hypervisor image region are contingent, starting
      * from `load_addr`. The bitmap region is on top of the root pool region.
+     * CPU_MASTER maps the image and bitmap regions, which every CPU then
+     * scrubs in parts. Each CPU clears its own CPU space.
      */
-    if (cpu()->id == CPU_MASTER) {
-        p_image = mem_ppages_get(load_addr, NUM_PAGES(image_load_size));
-        va = mem_alloc_vpage(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA, p_image.num_pages);
-        mem_map(&cpu()->as, va, &p_image, p_image.num_pages, PTE_HYP_FLAGS);
-        memset((void*)va, 0, p_image.num_pages * PAGE_SIZE);
-        mem_unmap(&cpu()->as, va, p_image.num_pages, true);
-
-        p_image = mem_ppages_get(load_addr + image_load_size + vm_image_size,
-            NUM_PAGES(image_noload_size));
-        va = mem_alloc_vpage(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA, p_image.num_pages);
-        mem_map(&cpu()->as, va, &p_image, p_image.num_pages, PTE_HYP_FLAGS);
-        memset((void*)va, 0, p_image.num_pages * PAGE_SIZE);
-        mem_unmap(&cpu()->as, va, p_image.num_pages, true);
+    struct ppages p_old[3] = {
+        mem_ppages_get(load_addr, NUM_PAGES(image_load_size)),
+        mem_ppages_get(load_addr + image_load_size + vm_image_size,
+                       NUM_PAGES(image_noload_size)),
+        mem_ppages_get(load_addr + image_size + vm_image_size +
+                           (cpu_boot_size * platform.cpu_num),
+                       NUM_PAGES(bitmap_size)),
+    };
 
-        p_bitmap = mem_ppages_get(load_addr + image_size + vm_image_size +
-                                      (cpu_boot_size * platform.cpu_num),
-                                  NUM_PAGES(bitmap_size));
+    if (cpu()->id == CPU_MASTER) {
+        for (size_t i = 0; i < 3; i++) {
+            shared_va[i] = mem_alloc_map(&cpu()->as, SEC_HYP_GLOBAL, &p_old[i],
+                                         INVALID_VA, p_old[i].num_pages,
+                                         PTE_HYP_FLAGS);
+        }
+    }
+    cpu_sync_barrier(&cpu_glb_sync);
 
-        va = mem_alloc_vpage(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA, p_bitmap.num_pages);
-        mem_map(&cpu()->as, va, &p_bitmap, p_bitmap.num_pages, PTE_HYP_FLAGS);
-        memset((void*)va, 0, p_bitmap.num_pages * PAGE_SIZE);
-        mem_unmap(&cpu()->as, va, p_bitmap.num_pages, true);
+    for (size_t i = 0; i < 3; i++) {
+        len = mem_color_chunk(p_old[i].num_pages * PAGE_SIZE, &off);
+        memset((void*)(shared_va[i] + off), 0, len);
     }
 
     p_cpu = mem_ppages_get(
@@ -924,6 +2027,117 @@ void mem_color_hypervisor(const paddr_t load_addr, struct mem_region *root_regio
     mem_map(&cpu()->as, va, &p_cpu,p_cpu.num_pages, PTE_HYP_FLAGS);
     memset((void*)va, 0,p_cpu.num_pages * PAGE_SIZE);
     mem_unmap(&cpu()->as, va,p_cpu.num_pages, false);
+
+    cpu_sync_barrier(&cpu_glb_sync);
+
+    if (cpu()->id == CPU_MASTER) {
+        for (size_t i = 0; i < 3; i++) {
+            mem_unmap(&cpu()->as, shared_va[i], p_old[i].num_pages, true);
+        }
+
+        ticks[5] = timer_get();
+        color_profile.cpu = ticks[1] - ticks[0];
+        color_profile.image = ticks[2] - ticks[1];
+        color_profile.bitmap = ticks[3] - ticks[2];
+        color_profile.flush = ticks[4] - ticks[3];
+        color_profile.scrub = ticks[5] - ticks[4];
+    }
+}
+
+/* Frames outside the hypervisor colors that are reported one by one */
+#define MEM_COLOR_AUDIT_MAX (8)
+
+struct mem_color_audit {
+    size_t frames;
+    size_t outside;
+};
+
+static void mem_color_audit_frame(struct mem_color_audit *audit, paddr_t pa)
+{
+    bool ram = false;
+
+    /* devices have no color */
+    for (size_t i = 0; i < platform.region_num && !ram; i++) {
+        struct mem_region *reg = &platform.regions[i];
+        ram = (pa >= reg->base) && ((pa - reg->base) < reg->size);
+    }
+    if (!ram) return;
+
+    audit->frames++;
+    if (!((config.hyp.colors >> ((pa / PAGE_SIZE / COLOR_SIZE) % COLOR_NUM)) &
+          1)) {
+        if (audit->outside++ < MEM_COLOR_AUDIT_MAX) {
+            WARNING("frame 0x%lx is outside the hypervisor colors",
+                    (unsigned long)pa);
+        }
+    }
+}
+
+/**
+ * Audits the page tables below the level lvl entries covering [va, last]
+ * and, if leaves, the frames these map.
+ */
+static void mem_color_audit_pt(struct addr_space *as, vaddr_t va,
+                               vaddr_t last, size_t lvl, bool leaves,
+                               struct mem_color_audit *audit)
+{
+    struct page_table *pt = &as->pt;
+    size_t lvlsz = pt_lvlsize(pt, lvl);
+
+    while (true) {
+        vaddr_t end = min(va | (lvlsz - 1), last);
+        pte_t *pte = pt_get_pte(pt, lvl, va);
+
+        if (!pte_valid(pte)) {
+            /* nothing mapped */
+        } else if (pte_table(pt, pte, lvl)) {
+            for (size_t i = 0; i < NUM_PAGES(pt_size(pt, lvl + 1)); i++) {
+                mem_color_audit_frame(audit, pte_addr(pte) + (i * PAGE_SIZE));
+            }
+            mem_color_audit_pt(as, va, end, lvl + 1, leaves, audit);
+        } else if (leaves) {
+            paddr_t pa = pte_addr(pte) + ((va & (lvlsz - 1)) & ~(PAGE_SIZE - 1));
+            size_t n = ((end - (va & ~(PAGE_SIZE - 1))) / PAGE_SIZE) + 1;
+            for (size_t i = 0; i < n; i++) {
+                mem_color_audit_frame(audit, pa + (i * PAGE_SIZE));
+            }
+        }
+
+        if (end == last) break;
+        va = end + 1;
+    }
+}
+
+/**
+ * Reports the hypervisor frames outside the hypervisor colors. Each cpu
+ * audits its private section, the master cpu the shared ones, so this must
+ * run once every vm was created. Each vm master also audits the vm page
+ * tables below the root, which lives in the shared vm section.
+ */
+void mem_color_audit(struct vm *vm)
+{
+    struct mem_color_audit audit = {0};
+
+    if (all_clrs(config.hyp.colors)) return;
+
+    for (size_t i = 0; i < sections[AS_HYP].sec_size; i++) {
+        struct section *sec = &sections[AS_HYP].sec[i];
+        if (!sec->shared || cpu()->id == CPU_MASTER) {
+            mem_color_audit_pt(&cpu()->as, sec->beg, sec->end, 0, true,
+                               &audit);
+        }
+    }
+
+    if (vm != NULL && vm->master == cpu()->id) {
+        for (size_t i = 0; i < sections[AS_VM].sec_size; i++) {
+            struct section *sec = &sections[AS_VM].sec[i];
+            mem_color_audit_pt(&vm->as, sec->beg, sec->end, 0, false, &audit);
+        }
+    }
+
+    INFO("cpu %lu color audit: %lu/%lu frames outside hypervisor colors",
+         (unsigned long)cpu()->id, (unsigned long)audit.outside,
+         (unsigned long)audit.frames);
 }
 
 void as_init(struct addr_space *as, enum AS_TYPE type, asid_t id, 
@@ -933,7 +2147,12 @@ void as_init(struct addr_space *as, enum AS_TYPE type, asid_t id,
     as->pt.dscr =
         type == AS_HYP || type == AS_HYP_CPY ? hyp_pt_dscr : vm_pt_dscr;
     as->colors = colors;
+    as->placement = (struct mem_placement){.policy = MEM_POLICY_ANY};
+    as->pt_cache.num = 0;
+    as->vas.seeded = false;
+    as->vas.overflow = false;
     as->lock = SPINLOCK_INITVAL;
+    spin_lock_name(&as->lock, "as");
     as->id = id;
 
     if (root_pt == NULL) {
@@ -7,7 +7,57 @@
 
 #include <config.h>
 #include <mem.h>
+#include <io.h>
 
 void vm_mem_prot_init(struct vm* vm, const struct vm_config* config) {
     as_init(&vm->as, AS_VM, vm->id, NULL, config->colors);
 }
+
+bool vm_mem_recolor(struct vm* vm, colormap_t colors)
+{
+    struct mem_recolor rclr;
+    size_t total = 0;
+    size_t window = 0;
+
+    /**
+     * Devices behind the iommu could keep reaching the old pages through
+     * stale iotlb entries once these are given back, so such vms stay put.
+     */
+    if (io_vm_has_devices(vm)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < vm->config->platform.region_num; i++) {
+        struct vm_mem_region* reg = &vm->config->platform.regions[i];
+        /* a region placed at a physical address can't take other colors */
+        if (reg->place_phys) {
+            return false;
+        }
+        total += NUM_PAGES(reg->size);
+        window = max(window, NUM_PAGES(reg->size));
+    }
+
+    /**
+     * Everything the move needs is reserved before the first region is
+     * touched, so the vm is either moved as a whole or left as it was.
+     */
+    if (total > 0 && !mem_recolor_begin(&rclr, colors, total, window)) {
+        return false;
+    }
+
+    vm->as.colors = colors;
+
+    if (total == 0) {
+        return true;
+    }
+
+    for (size_t i = 0; i < vm->config->platform.region_num; i++) {
+        struct vm_mem_region* reg = &vm->config->platform.regions[i];
+        mem_recolor(&vm->as, SEC_VM_ANY, reg->base, NUM_PAGES(reg->size),
+                    &rclr, PTE_VM_FLAGS);
+    }
+
+    mem_recolor_end(&rclr);
+
+    return true;
+}
@@ -9,7 +9,8 @@
 #include <bao.h>
 #include <bitmap.h>
 #include <arch/mem.h>
-#include <arch/spinlock.h>
+#include <spinlock.h>
+#include <mem_placement.h>
 
 #define HYP_ASID  0
 #define VMPU_NUM_ENTRIES  64
@@ -25,6 +26,8 @@ struct addr_space {
     asid_t id;
     enum AS_TYPE type;
     colormap_t colors;
+    /* unused, vm memory is always placed at its physical address */
+    struct mem_placement placement;
     struct mpe {
         enum { MPE_S_FREE, MPE_S_INVALID, MPE_S_VALID } state;
         struct mp_region region;
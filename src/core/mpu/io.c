@@ -20,3 +20,8 @@ bool io_vm_add_device(struct vm *vm, streamid_t dev_id)
 {
     return true;
 }
+
+bool io_vm_has_devices(struct vm *vm)
+{
+    return false;
+}
@@ -11,12 +11,13 @@
 #include <platform_defs.h>
 #include <objpool.h>
 #include <config.h>
+#include <atomic.h>
 
 struct shared_region {
     enum AS_TYPE as_type;
     asid_t asid;
     struct mp_region region;
-    cpumap_t sharing_cpus;
+    volatile unsigned long refs;
 };
 
 void mem_handle_broadcast_region(uint32_t event, uint64_t data);
@@ -194,6 +195,7 @@ void as_init(struct addr_space *as, enum AS_TYPE type, asid_t id, colormap_t col
 {
     as->type = type;
     as->colors = 0;
+    as->placement = (struct mem_placement){.policy = MEM_POLICY_ANY};
     as->id = id;
     as_arch_init(as);
 
@@ -204,12 +206,18 @@ void as_init(struct addr_space *as, enum AS_TYPE type, asid_t id, colormap_t col
 
 static void mem_free_ppages(struct ppages *ppages)
 {
+    if (mem_page_cache_put(ppages)) {
+        return;
+    }
+
     list_foreach(page_pool_list, struct page_pool, pool)
     {
         spin_lock(&pool->lock);
         if (in_range(ppages->base, pool->base, pool->size * PAGE_SIZE)) {
             size_t index = (ppages->base - pool->base) / PAGE_SIZE;
             bitmap_clear_consecutive(pool->bitmap, index, ppages->num_pages);
+            pp_sync_index(pool, index, ppages->num_pages);
+            pool->free += ppages->num_pages;
         }
         spin_unlock(&pool->lock);
     }
@@ -253,23 +261,31 @@ void mem_region_broadcast(struct addr_space *as, struct mp_region *mpr, uint32_t
         return;
     }
 
-    struct shared_region shared_region = {
-        .as_type = as->type,
-        .asid = as->id,
-        .region = *mpr,
-    };
+    cpumap_t trgt_cpus = shared_cpus & ~(1UL << cpu()->id);
+    if (trgt_cpus == 0) {
+        return;
+    }
 
+    /**
+     * A single node is shared by all targets. The last one to handle the
+     * message returns it to the pool.
+     */
+    struct shared_region *node = objpool_alloc(&shared_region_pool);
+    if (node == NULL) {
+        ERROR("Failed allocating shared region node");
+    }
+    node->as_type = as->type;
+    node->asid = as->id;
+    node->region = *mpr;
+    node->refs = 0;
     for (cpuid_t cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
-        if ((cpu()->id != cpuid) && bit_get(shared_cpus, cpuid)) {
-            struct shared_region *node = objpool_alloc(&shared_region_pool);
-            if (node == NULL) {
-                ERROR("Failed allocating shared region node");
-            }
-            *node = shared_region;
-            struct cpu_msg msg = {MEM_PROT_SYNC, op, (uintptr_t) node};
-            cpu_send_msg(cpuid, &msg);
+        if (bit_get(trgt_cpus, cpuid)) {
+            node->refs++;
         }
     }
+
+    struct cpu_msg msg = {MEM_PROT_SYNC, op, (uintptr_t) node};
+    cpu_send_msg_mask(trgt_cpus, &msg);
 }
 
 bool mem_vmpu_insert_region(struct addr_space *as, mpid_t mpid,
@@ -353,7 +369,9 @@ void mem_handle_broadcast_region(uint32_t event, uint64_t data)
                 ERROR("unknown mem broadcast msg");
         }
 
-        objpool_free(&shared_region_pool, sh_reg);
+        if (atomic_fetch_add(&sh_reg->refs, -1UL) == 1) {
+            objpool_free(&shared_region_pool, sh_reg);
+        }
     }
 }
 
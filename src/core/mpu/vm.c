@@ -9,3 +9,8 @@ void vm_mem_prot_init(struct vm* vm, const struct vm_config* config) {
     as_init(&vm->as, AS_VM, vm->id, 0);
 }
 
+bool vm_mem_recolor(struct vm* vm, colormap_t colors)
+{
+    /* vm memory is always placed at its physical address */
+    return false;
+}
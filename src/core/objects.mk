@@ -12,4 +12,7 @@ core-objs-y+=config.o
 core-objs-y+=console.o
 core-objs-y+=ipc.o
 core-objs-y+=objpool.o
+core-objs-y+=spinlock.o
 core-objs-y+=hypercall.o
+core-objs-y+=trace.o
+core-objs-y+=memguard.o
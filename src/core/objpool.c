@@ -4,22 +4,48 @@
  */
 
 #include <objpool.h>
+#include <cpu.h>
 #include <string.h>
 
 void objpool_init(struct objpool *objpool) {
     memset(objpool->pool, 0, objpool->objsize*objpool->num);
-    memset(objpool->bitmap, 0, BITMAP_SIZE(objpool->num));
+    memset(objpool->magazines, 0,
+        sizeof(struct objpool_magazine) * PLAT_CPU_NUM);
+    objpool->free_list = NULL;
+    objpool->next = 0;
+    objpool->taken = 0;
+    objpool->high_water = 0;
+    objpool->exhausted = 0;
 }
 
 void* objpool_alloc(struct objpool *objpool) {
+    struct objpool_magazine *mag = &objpool->magazines[cpu()->id];
+    if (mag->count > 0) {
+        mag->allocs++;
+        return mag->objs[--mag->count];
+    }
+
     void *obj = NULL;
     spin_lock(&objpool->lock);
-    ssize_t n = bitmap_find_nth(objpool->bitmap, objpool->num, 1, 0, false);
-    if (n >= 0) {
-        bitmap_set(objpool->bitmap, n);
-        obj = objpool->pool + (objpool->objsize * n);
+    if (objpool->free_list != NULL) {
+        obj = objpool->free_list;
+        objpool->free_list = *(void**)obj;
+    } else if (objpool->next < objpool->num) {
+        obj = objpool->pool + (objpool->objsize * objpool->next);
+        objpool->next++;
+    }
+    if (obj != NULL) {
+        objpool->taken++;
+        if (objpool->taken > objpool->high_water) {
+            objpool->high_water = objpool->taken;
+        }
+    } else {
+        objpool->exhausted++;
     }
     spin_unlock(&objpool->lock);
+    if (obj != NULL) {
+        mag->allocs++;
+    }
     return obj;
 }
 
@@ -30,11 +56,38 @@ void objpool_free(struct objpool *objpool, void* obj) {
         in_range(obj_addr, pool_addr, objpool->objsize * objpool->num);
     bool aligned = IS_ALIGNED(obj_addr-pool_addr, objpool->objsize);
     if (in_pool && aligned) {
-        size_t n = (obj_addr-pool_addr)/objpool->objsize;
+        struct objpool_magazine *mag = &objpool->magazines[cpu()->id];
+        mag->frees++;
+        if (mag->count < objpool->magazine_size) {
+            mag->objs[mag->count++] = obj;
+            return;
+        }
         spin_lock(&objpool->lock);
-        bitmap_clear(objpool->bitmap, n);
+        *(void**)obj = objpool->free_list;
+        objpool->free_list = obj;
+        objpool->taken--;
         spin_unlock(&objpool->lock);
     } else {
 	WARNING("leaked while trying to free stray object");
     }
 }
+
+void objpool_dump(struct objpool *objpool) {
+    /**
+     * Each cpu only counts its own allocations and frees, and objects may be
+     * freed on another cpu than the one that allocated them, so only the
+     * sums make sense.
+     */
+    size_t allocs = 0;
+    size_t frees = 0;
+    for (size_t i = 0; i < PLAT_CPU_NUM; i++) {
+        allocs += objpool->magazines[i].allocs;
+        frees += objpool->magazines[i].frees;
+    }
+
+    INFO("%s: %lu objects in use %lu taken %lu high water %lu exhausted %lu",
+         objpool->name != NULL ? objpool->name : "objpool",
+         (unsigned long)objpool->num, (unsigned long)(allocs - frees),
+         (unsigned long)objpool->taken, (unsigned long)objpool->high_water,
+         (unsigned long)objpool->exhausted);
+}
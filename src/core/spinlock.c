@@ -0,0 +1,233 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <spinlock.h>
+
+#ifdef SPINLOCK_MCS
+
+#include <cpu.h>
+#include <atomic.h>
+#include <platform_defs.h>
+
+/**
+ * Maximum number of MCS locks a single cpu may hold at the same time.
+ */
+#define SPINLOCK_MCS_NODES (8)
+
+struct spinlock_node {
+    volatile unsigned long next;
+    volatile unsigned long waiting;
+    raw_spinlock_t* lock;
+};
+
+/**
+ * Nodes must be visible to all cpus, so they can't live in the cpu private
+ * area nor on the stack.
+ */
+static struct spinlock_node spinlock_nodes[PLAT_CPU_NUM][SPINLOCK_MCS_NODES];
+
+static struct spinlock_node* spinlock_node_get(raw_spinlock_t* lock)
+{
+    struct spinlock_node* nodes = spinlock_nodes[cpu()->id];
+
+    for (size_t i = 0; i < SPINLOCK_MCS_NODES; i++) {
+        if (nodes[i].lock == lock) {
+            return &nodes[i];
+        }
+    }
+
+    return NULL;
+}
+
+void raw_spin_lock(raw_spinlock_t* lock)
+{
+    struct spinlock_node* node = spinlock_node_get(NULL);
+    if (node == NULL) {
+        ERROR("too many nested spinlocks");
+    }
+
+    node->lock = lock;
+    node->next = 0;
+    node->waiting = true;
+
+    struct spinlock_node* prev =
+        (struct spinlock_node*)atomic_swap(lock, (unsigned long)node);
+    if (prev != NULL) {
+        atomic_store_rel(&prev->next, (unsigned long)node);
+        while (atomic_load_acq(&node->waiting));
+    }
+}
+
+void raw_spin_unlock(raw_spinlock_t* lock)
+{
+    struct spinlock_node* node = spinlock_node_get(lock);
+    if (node == NULL) {
+        ERROR("releasing spinlock not held by this cpu");
+    }
+
+    struct spinlock_node* next =
+        (struct spinlock_node*)atomic_load_acq(&node->next);
+    if (next == NULL) {
+        if (atomic_cas(lock, (unsigned long)node, 0)) {
+            node->lock = NULL;
+            return;
+        }
+        /* a new waiter swapped itself in but has not linked yet */
+        while ((next = (struct spinlock_node*)atomic_load_acq(&node->next)) ==
+               NULL);
+    }
+
+    atomic_store_rel(&next->waiting, false);
+    node->lock = NULL;
+}
+
+#endif /* SPINLOCK_MCS */
+
+#ifdef LOCK_STATS
+
+#include <fences.h>
+
+#define LOCK_STATS_MAX_DEFAULT (256)
+#ifndef LOCK_STATS_MAX
+#define LOCK_STATS_MAX LOCK_STATS_MAX_DEFAULT
+#endif
+
+static spinlock_t* lock_stats_registry[LOCK_STATS_MAX];
+static volatile size_t lock_stats_num;
+static size_t lock_stats_dropped;
+static raw_spinlock_t lock_stats_lock = RAW_SPINLOCK_INITVAL;
+
+void lock_stats_register(spinlock_t* lock)
+{
+    raw_spin_lock(&lock_stats_lock);
+
+    /* Locks re-initialized at run time might already be in the registry */
+    bool found = false;
+    for (size_t i = 0; i < lock_stats_num; i++) {
+        if (lock_stats_registry[i] == lock) {
+            found = true;
+            break;
+        }
+    }
+
+    if (!found) {
+        if (lock_stats_num < LOCK_STATS_MAX) {
+            lock_stats_registry[lock_stats_num] = lock;
+            fence_ord_write();
+            lock_stats_num++;
+        } else {
+            lock_stats_dropped++;
+        }
+    }
+    lock->stats.registered = true;
+
+    raw_spin_unlock(&lock_stats_lock);
+}
+
+void lock_stats_dump()
+{
+    /**
+     * The registry is append-only, so it is walked without taking
+     * lock_stats_lock, as printing might itself register the console lock.
+     */
+    size_t num = lock_stats_num;
+    fence_ord_read();
+
+    INFO("lock stats: %lu locks (%lu not tracked)", (unsigned long)num,
+         (unsigned long)lock_stats_dropped);
+    for (size_t i = 0; i < num; i++) {
+        spinlock_t* lock = lock_stats_registry[i];
+        struct lock_stats stats = lock->stats;
+        INFO("%s@0x%lx acq %lu cont %lu spin total %lu max %lu",
+             stats.name != NULL ? stats.name : "lock",
+             (unsigned long)(uintptr_t)lock,
+             (unsigned long)stats.acquisitions,
+             (unsigned long)stats.contended,
+             (unsigned long)stats.spin_total,
+             (unsigned long)stats.spin_max);
+    }
+}
+
+#else
+
+void lock_stats_dump()
+{
+    INFO("lock stats not enabled (build with LOCK_STATS=y)");
+}
+
+#endif /* LOCK_STATS */
+
+#ifdef LOCK_BENCH
+
+#include <cpu.h>
+#include <timer.h>
+#include <platform.h>
+
+#define LOCK_BENCH_ITERS (10000)
+
+#if defined(SPINLOCK_MCS)
+#define LOCK_BENCH_IMPL "mcs"
+#elif defined(SPINLOCK_TICKET)
+#define LOCK_BENCH_IMPL "ticket"
+#else
+#define LOCK_BENCH_IMPL "tas"
+#endif
+
+static spinlock_t lock_bench_lock = SPINLOCK_NAMED_INITVAL("lock_bench");
+static volatile size_t lock_bench_count;
+static struct {
+    uint64_t total;
+    uint64_t max;
+} lock_bench_cpus[PLAT_CPU_NUM];
+
+/**
+ * All cpus take the same lock LOCK_BENCH_ITERS times, as fast as they can.
+ * Each records how long it waited for every acquisition, from the call to
+ * spin_lock to getting the lock. The lock protected counter must add up
+ * in the end, which checks mutual exclusion along the way.
+ */
+void lock_bench()
+{
+    uint64_t total = 0;
+    uint64_t max = 0;
+
+    cpu_sync_barrier(&cpu_glb_sync);
+
+    for (size_t i = 0; i < LOCK_BENCH_ITERS; i++) {
+        uint64_t start = timer_get();
+        spin_lock(&lock_bench_lock);
+        uint64_t wait = timer_get() - start;
+        lock_bench_count++;
+        spin_unlock(&lock_bench_lock);
+
+        total += wait;
+        if (wait > max) {
+            max = wait;
+        }
+    }
+
+    lock_bench_cpus[cpu()->id].total = total;
+    lock_bench_cpus[cpu()->id].max = max;
+
+    cpu_sync_barrier(&cpu_glb_sync);
+
+    if (cpu()->id == CPU_MASTER) {
+        size_t expected = platform.cpu_num * LOCK_BENCH_ITERS;
+        INFO("lock bench (%s): %lu cpus %lu acquisitions each, timer %lu Hz",
+             LOCK_BENCH_IMPL, (unsigned long)platform.cpu_num,
+             (unsigned long)LOCK_BENCH_ITERS, (unsigned long)timer_get_freq());
+        for (size_t i = 0; i < platform.cpu_num; i++) {
+            INFO("cpu %lu wait avg %lu max %lu ticks", (unsigned long)i,
+                 (unsigned long)(lock_bench_cpus[i].total / LOCK_BENCH_ITERS),
+                 (unsigned long)lock_bench_cpus[i].max);
+        }
+        if (lock_bench_count != expected) {
+            ERROR("lock bench counted %lu acquisitions, expected %lu",
+                  (unsigned long)lock_bench_count, (unsigned long)expected);
+        }
+    }
+}
+
+#endif /* LOCK_BENCH */
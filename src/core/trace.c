@@ -0,0 +1,122 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <trace.h>
+
+#ifdef TRACE
+
+#include <cpu.h>
+#include <vm.h>
+#include <mem.h>
+#include <ipc.h>
+#include <config.h>
+#include <timer.h>
+#include <fences.h>
+#include <string.h>
+
+#if (TRACE_RING_PAGES & (TRACE_RING_PAGES - 1)) != 0
+#error "TRACE_RING_PAGES must be a power of two"
+#endif
+
+#define TRACE_RECORD_NUM \
+    ((TRACE_RING_PAGES * PAGE_SIZE) / sizeof(struct trace_record))
+#define TRACE_HEADER_SIZE                                            \
+    ALIGN(sizeof(struct trace_header) +                              \
+              (PLAT_CPU_NUM * sizeof(struct trace_ring_ctl)),        \
+          PAGE_SIZE)
+#define TRACE_SIZE \
+    (TRACE_HEADER_SIZE + (PLAT_CPU_NUM * TRACE_RING_PAGES * PAGE_SIZE))
+
+/**
+ * Written once by the master cpu before the global sync at the end of
+ * vmm_init. Events raised before that are dropped.
+ */
+static struct trace_header* volatile trace_buf;
+
+static struct trace_header* trace_alloc()
+{
+    size_t num_pages = NUM_PAGES(TRACE_SIZE);
+
+    if (config.hyp.trace_export) {
+        struct shmem* shmem = ipc_get_shmem(config.hyp.trace_shmem_id);
+        if (shmem == NULL) {
+            WARNING("Invalid trace shmem id. Trace will not be exported.");
+        } else if (shmem->size < TRACE_SIZE) {
+            WARNING("Trace shmem too small (0x%lx bytes needed). "
+                    "Trace will not be exported.", TRACE_SIZE);
+        } else {
+            struct ppages ppages = mem_ppages_get(shmem->phys, num_pages);
+            ppages.colors = shmem->colors;
+            vaddr_t va = mem_alloc_map(&cpu()->as, SEC_HYP_GLOBAL, &ppages,
+                                       INVALID_VA, num_pages, PTE_HYP_FLAGS);
+            if (va != INVALID_VA) {
+                return (struct trace_header*)va;
+            }
+            WARNING("Failed to map trace shmem. Trace will not be exported.");
+        }
+    }
+
+    return mem_alloc_page(num_pages, SEC_HYP_GLOBAL, false);
+}
+
+void trace_init()
+{
+    if (cpu()->id == CPU_MASTER) {
+        struct trace_header* buf = trace_alloc();
+        if (buf == NULL) {
+            WARNING("Failed to allocate trace buffer");
+            return;
+        }
+
+        memset(buf, 0, TRACE_HEADER_SIZE);
+        buf->magic = TRACE_MAGIC;
+        buf->version = TRACE_VERSION;
+        buf->cpu_num = PLAT_CPU_NUM;
+        buf->record_num = TRACE_RECORD_NUM;
+        buf->record_size = sizeof(struct trace_record);
+        buf->rings_offset = TRACE_HEADER_SIZE;
+        buf->timer_freq = timer_get_freq();
+
+        fence_ord_write();
+        trace_buf = buf;
+    }
+}
+
+void trace_event(enum trace_event event, unsigned long arg0,
+                 unsigned long arg1)
+{
+    struct trace_header* buf = trace_buf;
+    if (buf == NULL) {
+        return;
+    }
+
+    /**
+     * Each cpu is the only writer of its ring and the hypervisor is not
+     * preemptible, so head always equals commit here.
+     */
+    struct trace_ring_ctl* ctl = &buf->ring[cpu()->id];
+    uint32_t idx = ctl->head;
+    struct trace_record* records =
+        (struct trace_record*)((uintptr_t)buf + TRACE_HEADER_SIZE) +
+        (cpu()->id * TRACE_RECORD_NUM);
+    struct trace_record* rec = &records[idx & (TRACE_RECORD_NUM - 1)];
+    struct vcpu* vcpu = cpu()->vcpu;
+
+    ctl->head = idx + 1;
+    fence_ord_write();
+
+    rec->timestamp = timer_get();
+    rec->event = event;
+    rec->vmid = (vcpu != NULL) ? vcpu->vm->id : TRACE_NO_ID;
+    rec->vcpuid = (vcpu != NULL) ? vcpu->id : TRACE_NO_ID;
+    rec->cpuid = cpu()->id;
+    rec->args[0] = arg0;
+    rec->args[1] = arg1;
+
+    fence_ord_write();
+    ctl->commit = idx + 1;
+}
+
+#endif /* TRACE */
@@ -8,6 +8,8 @@
 #include <mem.h>
 #include <cache.h>
 #include <config.h>
+#include <platform.h>
+#include <memguard.h>
 
 static void vm_master_init(struct vm* vm, const struct vm_config* config, vmid_t vm_id)
 {
@@ -148,18 +150,35 @@ static void vm_map_img_rgn(struct vm* vm, const struct vm_config* config,
     }
 }
 
+static void vm_set_mem_placement(struct vm* vm, struct vm_mem_region* reg)
+{
+    struct mem_placement placement = reg->placement;
+
+    if (placement.policy == MEM_POLICY_REGION &&
+        placement.region >= platform.region_num) {
+        WARNING("Invalid placement region in vm configuration. Ignored.");
+        placement.policy = MEM_POLICY_ANY;
+    }
+    placement.cpus = vm->cpus;
+    placement.next = 0;
+
+    vm->as.placement = placement;
+}
+
 static void vm_init_mem_regions(struct vm* vm, const struct vm_config* config)
 {
     for (size_t i = 0; i < config->platform.region_num; i++) {
         struct vm_mem_region* reg = &config->platform.regions[i];
         bool img_is_in_rgn = range_in_range(
             config->image.base_addr, config->image.size, reg->base, reg->size);
+        vm_set_mem_placement(vm, reg);
         if (img_is_in_rgn) {
             vm_map_img_rgn(vm, config, reg);
         } else {
             vm_map_mem_region(vm, reg);
         }
     }
+    vm->as.placement = (struct mem_placement){.policy = MEM_POLICY_ANY};
 }
 
 static void vm_init_ipc(struct vm* vm, const struct vm_config* config)
@@ -274,6 +293,14 @@ struct vm* vm_init(struct vm_allocation* vm_alloc, const struct vm_config* confi
         vm_init_ipc(vm, config);
     }
 
+    cpu_sync_barrier(&vm->sync);
+
+    /**
+     * Only now are the vm's interrupts known, so that the regulator does
+     * not take over one that was assigned to the guest.
+     */
+    memguard_init(vm, config);
+
     cpu_sync_and_clear_msgs(&vm->sync);
 
     return vm;
@@ -317,12 +344,7 @@ emul_handler_t vm_emul_get_reg(struct vm* vm, vaddr_t addr)
 
 void vm_msg_broadcast(struct vm* vm, struct cpu_msg* msg)
 {
-    for (size_t i = 0, n = 0; n < vm->cpu_num - 1; i++) {
-        if (((1U << i) & vm->cpus) && (i != cpu()->id)) {
-            n++;
-            cpu_send_msg(i, msg);
-        }
-    }
+    cpu_send_msg_mask(vm->cpus & ~(1UL << cpu()->id), msg);
 }
 
 __attribute__((weak)) cpumap_t vm_translate_to_pcpu_mask(struct vm* vm,
@@ -355,6 +377,24 @@ __attribute__((weak)) cpumap_t vm_translate_to_vcpu_mask(struct vm* vm,
     return pmask;
 }
 
+bool vm_recolor(struct vm* vm, colormap_t colors)
+{
+    bool ret = true;
+
+    /**
+     * Every vm cpu is held here, with its vcpu stopped, while the master
+     * moves the vm memory. The old translations were invalidated on all
+     * cpus by the time the barrier is left.
+     */
+    cpu_sync_barrier(&vm->sync);
+    if (cpu()->id == vm->master && !vm_mem_recolor(vm, colors)) {
+        ret = false;
+    }
+    cpu_sync_barrier(&vm->sync);
+
+    return ret;
+}
+
 void vcpu_run(struct vcpu* vcpu)
 {
     cpu()->vcpu->active = true;
@@ -11,6 +11,8 @@
 #include <fences.h>
 #include <string.h>
 #include <ipc.h>
+#include <trace.h>
+#include <hypercall.h>
 
 static struct vm_assignment {
     spinlock_t lock;
@@ -125,20 +127,89 @@ static struct vm_allocation* vmm_alloc_install_vm(vmid_t vm_id, bool master) {
     return vm_alloc;
 }
 
+/* must be reachable by the target cpus, see cpu_call_sync */
+static struct vmm_recolor_req {
+    volatile unsigned long busy;
+    colormap_t colors;
+} vmm_recolor_req;
+
+static long vmm_recolor_call(void* arg)
+{
+    struct vmm_recolor_req* req = arg;
+    return vm_recolor(cpu()->vcpu->vm, req->colors) ? HC_E_SUCCESS
+                                                     : -HC_E_FAILURE;
+}
+
+unsigned long vmm_recolor_hypercall(unsigned long vm_id, unsigned long colors,
+                                    unsigned long arg2)
+{
+    colormap_t mask = (((colormap_t)1) << COLOR_NUM) - 1;
+    long ret[PLAT_CPU_NUM];
+
+    if (!cpu()->vcpu->vm->config->recolor_ctl) {
+        return -HC_E_FAILURE;
+    }
+
+    if (vm_id >= config.vmlist_size || vm_assign[vm_id].cpus == 0 ||
+        (colors & mask) == 0) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    /**
+     * Waiting for an ongoing request could deadlock if its vm includes this
+     * cpu, so only one is taken at a time.
+     */
+    if (!atomic_cas(&vmm_recolor_req.busy, 0, 1)) {
+        return -HC_E_FAILURE;
+    }
+
+    cpumap_t targets = vm_assign[vm_id].cpus;
+    vmm_recolor_req.colors = colors & mask;
+    cpumap_t done = cpu_call_sync(targets, vmm_recolor_call, &vmm_recolor_req,
+                                  ret, CPU_CALL_NO_TIMEOUT);
+
+    unsigned long res = HC_E_SUCCESS;
+    for (cpuid_t cpu = 0; cpu < PLAT_CPU_NUM; cpu++) {
+        if (bit_get(targets, cpu) &&
+            (!bit_get(done, cpu) || ret[cpu] != HC_E_SUCCESS)) {
+            res = -HC_E_FAILURE;
+        }
+    }
+
+    fence_ord_write();
+    vmm_recolor_req.busy = 0;
+
+    return res;
+}
+
 void vmm_init()
 {
     vmm_arch_init();
     vmm_io_init();
     ipc_init();
+    trace_init();
 
     cpu_sync_barrier(&cpu_glb_sync);
 
     bool master = false;
     vmid_t vm_id = -1;
+    struct vm *vm = NULL;
     if (vmm_assign_vcpu(&master, &vm_id)) {
         struct vm_allocation *vm_alloc = vmm_alloc_install_vm(vm_id, master);
         struct vm_config *vm_config = &config.vmlist[vm_id];
-        struct vm *vm = vm_init(vm_alloc, vm_config, master, vm_id);
+        vm = vm_init(vm_alloc, vm_config, master, vm_id);
+    }
+
+    /**
+     * With the hypervisor colored, wait for every vm to be created and
+     * check all hypervisor frames landed in its colors.
+     */
+    if (!all_clrs(config.hyp.colors)) {
+        cpu_sync_barrier(&cpu_glb_sync);
+        mem_color_audit(vm);
+    }
+
+    if (vm != NULL) {
         cpu_sync_barrier(&vm->sync);
         vcpu_run(cpu()->vcpu);
     } else {
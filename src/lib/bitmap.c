@@ -5,100 +5,195 @@
 
 #include <bitmap.h>
 
+#define BITMAP_WORD(BIT) ((BIT) / BITMAP_GRANULE_LEN)
+#define BITMAP_OFF(BIT) ((BIT) % BITMAP_GRANULE_LEN)
+
+/* Mask of the bits at and above off */
+static inline bitmap_granule_t bitmap_mask_from(size_t off)
+{
+    return ~((bitmap_granule_t)0) << off;
+}
+
+/* Mask of the bits below off, off must not be zero */
+static inline bitmap_granule_t bitmap_mask_to(size_t off)
+{
+    return BITMAP_GRANULE_MASK(0, off);
+}
+
+static inline bitmap_granule_t bitmap_word(bitmap_t* map, size_t word,
+                                           bool set)
+{
+    return set ? map[word] : ~map[word];
+}
+
 ssize_t bitmap_find_nth(bitmap_t* map, size_t size, size_t nth, size_t start,
                         bool set)
 {
-    if (size <= 0 || nth <= 0 || start < 0) return -1;
+    if (size == 0 || nth == 0 || start >= size) return -1;
 
-    size_t count = 0;
-    unsigned bit = set ? 1 : 0;
+    size_t last = BITMAP_WORD(size - 1);
+    size_t w = BITMAP_WORD(start);
+    bitmap_granule_t word =
+        bitmap_word(map, w, set) & bitmap_mask_from(BITMAP_OFF(start));
+
+    while (true) {
+        if (w == last && BITMAP_OFF(size) != 0) {
+            word &= bitmap_mask_to(BITMAP_OFF(size));
+        }
 
-    for (ssize_t i = start; i < size; i++) {
-        if (bitmap_get(map, i) == bit) {
-            if (++count == nth) return i;
+        size_t count = bit_count(word);
+        if (count >= nth) {
+            while (--nth > 0) {
+                word &= word - 1;
+            }
+            return (ssize_t)((w * BITMAP_GRANULE_LEN) + bit_ctz(word));
         }
+
+        nth -= count;
+        if (++w > last) break;
+        word = bitmap_word(map, w, set);
     }
 
     return -1;
 }
 
+size_t bitmap_count(bitmap_t* map, size_t start, size_t end, bool set)
+{
+    if (end <= start) return 0;
+
+    size_t count = 0;
+    size_t w = BITMAP_WORD(start);
+    size_t last = BITMAP_WORD(end - 1);
+    bitmap_granule_t word =
+        bitmap_word(map, w, set) & bitmap_mask_from(BITMAP_OFF(start));
+
+    for (; w < last; w++) {
+        count += bit_count(word);
+        word = bitmap_word(map, w + 1, set);
+    }
+
+    if (BITMAP_OFF(end) != 0) {
+        word &= bitmap_mask_to(BITMAP_OFF(end));
+    }
+
+    return count + bit_count(word);
+}
+
 size_t bitmap_count_consecutive(bitmap_t* map, size_t size, size_t start,
                                 size_t n)
 {
+    if (n <= 1) return n;
+    if (start >= size) return 0;
+
+    size_t limit = min(n, size - start);
+    bool set = !!bitmap_get(map, start);
     size_t pos = start;
     size_t count = 0;
-    size_t start_offset = start % BITMAP_GRANULE_LEN;
-    size_t first_word_bits = min(BITMAP_GRANULE_LEN - start_offset, n);
-    bool set = !!bitmap_get(map, start);
-    bitmap_granule_t init_mask = BITMAP_GRANULE_MASK(start_offset, first_word_bits);
-    bitmap_granule_t mask;
-
-    if (n <= 1) return n;
 
-    mask = set ? init_mask : ~init_mask;
-    if (!((map[pos/BITMAP_GRANULE_LEN] ^ mask) & init_mask)) {
-        count += first_word_bits;
-        pos += first_word_bits;
-    }
+    while (count < limit) {
+        size_t off = BITMAP_OFF(pos);
+        /* bits that end the run */
+        bitmap_granule_t word = bitmap_word(map, BITMAP_WORD(pos), !set) >> off;
 
-    mask = set ? ~0 : 0;
-    while (!(map[pos/BITMAP_GRANULE_LEN] ^ mask) && (count < n)) {
-        count += BITMAP_GRANULE_LEN;
-        pos += BITMAP_GRANULE_LEN;
-    }
+        if (word != 0) {
+            count += bit_ctz(word);
+            break;
+        }
 
-    while ((!!bitmap_get(map, pos) == set) && (count < n)) {
-        count++;
-        pos += 1;
+        count += BITMAP_GRANULE_LEN - off;
+        pos += BITMAP_GRANULE_LEN - off;
     }
 
-    return count;
+    return min(count, limit);
 }
 
 ssize_t bitmap_find_consec(bitmap_t* map, size_t size, size_t start, size_t n,
                             bool set)
 {
-    ssize_t count = 0;
-    ssize_t i = 0;
-
-    // find first set
-    if ((i = bitmap_find_nth(map, size, 1, start, set)) < 0) return -1;
-
-    while (i < size) {
-        // find the last (with n as maximum) contiguous set page
-        count = bitmap_count_consecutive(map, size, i, n);
-        if (count < n) {  // if didn't found enough n contiguous set pages
-            i += count;
-            // find the last contiguous ~set page
-            i += bitmap_count_consecutive(map, size, i, -1);
+    if (n <= 1) return bitmap_find_nth(map, size, 1, start, set);
+    if (start >= size || n > size - start) return -1;
+
+    /**
+     * Runs are tracked across words so that each word is looked at once. run
+     * is the length of the matching run that ends at the current word's
+     * first bit.
+     */
+    size_t run = 0;
+    size_t w = BITMAP_WORD(start);
+    size_t last = BITMAP_WORD(size - 1);
+    size_t base = w * BITMAP_GRANULE_LEN;
+    bitmap_granule_t word =
+        bitmap_word(map, w, set) & bitmap_mask_from(BITMAP_OFF(start));
+
+    while (true) {
+        if (w == last && BITMAP_OFF(size) != 0) {
+            word &= bitmap_mask_to(BITMAP_OFF(size));
+        }
+
+        if (word == ~((bitmap_granule_t)0)) {
+            run += BITMAP_GRANULE_LEN;
         } else {
-            break;
+            size_t ones = bit_ctz(~word);
+            if (run + ones >= n) {
+                return (ssize_t)(base - run);
+            }
+
+            run = 0;
+            word &= bitmap_mask_from(ones);
+            while (word != 0) {
+                size_t s = bit_ctz(word);
+                bitmap_granule_t rest = ~word & bitmap_mask_from(s);
+                if (rest == 0) {
+                    run = BITMAP_GRANULE_LEN - s;
+                    break;
+                }
+                size_t e = bit_ctz(rest);
+                if (e - s >= n) {
+                    return (ssize_t)(base + s);
+                }
+                word &= bitmap_mask_from(e);
+            }
         }
+
+        if (run >= n) {
+            return (ssize_t)(base + BITMAP_GRANULE_LEN - run);
+        }
+        if (++w > last) break;
+        base += BITMAP_GRANULE_LEN;
+        word = bitmap_word(map, w, set);
     }
 
-    if (i >= size) i = -1;
+    return -1;
+}
+
+static void bitmap_update_consecutive(bitmap_t* map, size_t start, size_t n,
+                                      bool set)
+{
+    if (n == 0) return;
+
+    size_t w = BITMAP_WORD(start);
+    size_t last = BITMAP_WORD(start + n - 1);
+    bitmap_granule_t mask = bitmap_mask_from(BITMAP_OFF(start));
 
-    return i;
+    for (; w <= last; w++) {
+        if (w == last && BITMAP_OFF(start + n) != 0) {
+            mask &= bitmap_mask_to(BITMAP_OFF(start + n));
+        }
+        if (set) {
+            map[w] |= mask;
+        } else {
+            map[w] &= ~mask;
+        }
+        mask = ~((bitmap_granule_t)0);
+    }
 }
 
 void bitmap_set_consecutive(bitmap_t* map, size_t start, size_t n)
 {
-    size_t pos = start;
-    size_t count = n;
-    size_t start_offset = start % BITMAP_GRANULE_LEN;
-    size_t first_word_bits = min(BITMAP_GRANULE_LEN - start_offset, count); 
-
-    map[pos/BITMAP_GRANULE_LEN] |= BITMAP_GRANULE_MASK(start_offset, first_word_bits);
-    pos += first_word_bits;
-    count -= first_word_bits;
-
-    while (count >= BITMAP_GRANULE_LEN) {
-        map[pos/BITMAP_GRANULE_LEN] |= ~0;
-        pos += BITMAP_GRANULE_LEN;
-        count -= BITMAP_GRANULE_LEN;
-    }
+    bitmap_update_consecutive(map, start, n, true);
+}
 
-    if (count > 0) {
-        map[pos/BITMAP_GRANULE_LEN] |= BITMAP_GRANULE_MASK(0, count);
-    }
+void bitmap_clear_consecutive(bitmap_t* map, size_t start, size_t n)
+{
+    bitmap_update_consecutive(map, start, n, false);
 }
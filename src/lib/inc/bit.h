@@ -47,6 +47,67 @@ BIT_OPS_GEN(bit32, uint32_t, UINT32_C(1), BIT32_MASK);
 BIT_OPS_GEN(bit64, uint64_t, UINT64_C(1), BIT64_MASK);
 BIT_OPS_GEN(bit, unsigned long, (1UL), BIT_MASK);
 
+#define BIT_WORD_LEN (sizeof(unsigned long) * 8)
+
+/**
+ * Count trailing/leading zeros and set bits of a machine word. The compiler
+ * builtins are only used where they expand to instructions: without Zbb on
+ * riscv, or without the FP/SIMD unit (popcount) on arm, they become libgcc
+ * calls which the hypervisor does not link against. The fallbacks are
+ * branchless, as the bitmap searches feed them unpredictable words.
+ */
+#if defined(__riscv_zbb)
+
+static inline size_t bit_count(unsigned long word)
+{
+    return (size_t)__builtin_popcountl(word);
+}
+
+#else
+
+static inline size_t bit_count(unsigned long word)
+{
+    word = word - ((word >> 1) & (~0UL / 3));
+    word = (word & (~0UL / 15 * 3)) + ((word >> 2) & (~0UL / 15 * 3));
+    word = (word + (word >> 4)) & (~0UL / 255 * 15);
+    return (size_t)((word * (~0UL / 255)) >> (BIT_WORD_LEN - 8));
+}
+
+#endif
+
+#if defined(__aarch64__) || defined(__arm__) || defined(__riscv_zbb)
+
+/* word must not be zero */
+static inline size_t bit_ctz(unsigned long word)
+{
+    return (size_t)__builtin_ctzl(word);
+}
+
+/* word must not be zero */
+static inline size_t bit_clz(unsigned long word)
+{
+    return (size_t)__builtin_clzl(word);
+}
+
+#else
+
+/* Counts the ones below the lowest set bit */
+static inline size_t bit_ctz(unsigned long word)
+{
+    return bit_count((word & -word) - 1);
+}
+
+/* Counts the zeros left after smearing the highest set bit downwards */
+static inline size_t bit_clz(unsigned long word)
+{
+    for (size_t s = 1; s < BIT_WORD_LEN; s *= 2) {
+        word |= word >> s;
+    }
+    return BIT_WORD_LEN - bit_count(word);
+}
+
+#endif
+
 #endif /* |__ASSEMBLER__ */
 
 #endif /* __BIT_H__ */
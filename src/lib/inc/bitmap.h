@@ -9,15 +9,17 @@
 #include <bao.h>
 #include <bit.h>
 
-/* TODO: needs optimizations */
-
-typedef uint32_t bitmap_granule_t;
+/**
+ * Granules are native machine words so that searches can skip whole words
+ * and use the bit_ctz/bit_count helpers on them.
+ */
+typedef unsigned long bitmap_granule_t;
 typedef bitmap_granule_t bitmap_t;
 
 static const bitmap_granule_t ONE = 1;
 
 #define BITMAP_GRANULE_LEN (sizeof(bitmap_granule_t) * 8)
-#define BITMAP_GRANULE_MASK(O, L)   BIT32_MASK((O), (L))
+#define BITMAP_GRANULE_MASK(O, L)   BIT_MASK((O), (L))
 
 #define BITMAP_SIZE(SIZE) (((SIZE) / BITMAP_GRANULE_LEN) + \
                           ((SIZE) % BITMAP_GRANULE_LEN ? 1 : 0))
@@ -46,23 +48,10 @@ static inline unsigned bitmap_get(bitmap_t* map, size_t bit)
 }
 
 void bitmap_set_consecutive(bitmap_t* map, size_t start, size_t n);
+void bitmap_clear_consecutive(bitmap_t* map, size_t start, size_t n);
 
-static inline void bitmap_clear_consecutive(bitmap_t* map, size_t start,
-                                            size_t n)
-{
-    for (size_t i = 0; i < n; i++) bitmap_clear(map, start + i);
-}
-
-static inline size_t bitmap_count(bitmap_t* map, size_t start, size_t n,
-                                    bool set)
-{
-    size_t count = 0;
-    for (size_t i = start; i < n; i++) {
-        if (bitmap_get(map, i) == set) count++;
-    }
-
-    return count;
-}
+/* Counts the bits equal to set in [start, end[ */
+size_t bitmap_count(bitmap_t* map, size_t start, size_t end, bool set);
 
 ssize_t bitmap_find_nth(bitmap_t* map, size_t size, size_t nth, size_t start,
                         bool set);